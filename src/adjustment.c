@@ -0,0 +1,202 @@
+#include <math.h>
+#include <string.h>
+
+#include "adjustment.h"
+#include "pixel.h"
+
+// Pixels are adjusted in batches this long, on a copy kept on the stack.
+#define APPLY_CHUNK 256
+
+const char *const ADJUSTMENT_NAMES[ADJUST_TYPE_COUNT] = {
+    [ADJUST_LEVELS] = "Levels",
+    [ADJUST_CURVES] = "Curves",
+    [ADJUST_HUE_SATURATION] = "Hue / Saturation",
+    [ADJUST_BRIGHTNESS_CONTRAST] = "Brightness / Contrast",
+};
+
+Adjustment *adjustment_new(AdjustmentType type)
+{
+    Adjustment *adj = g_new0(Adjustment, 1);
+    AdjustmentParams *p = &adj->params;
+
+    p->type = type;
+    p->in_white = 1.0;
+    p->gamma = 1.0;
+    p->out_white = 1.0;
+    p->n_points = 2;
+    p->points[1][0] = 1.0;
+    p->points[1][1] = 1.0;
+    adjustment_compile(adj);
+    return adj;
+}
+
+// Monotone cubic interpolation through the curve points (Fritsch-Carlson),
+// so the curve never overshoots between two points.
+double adjustment_curve_eval(const AdjustmentParams *p, double x)
+{
+    const double (*pt)[2] = p->points;
+    guint n = p->n_points;
+
+    if (n == 0) return x;
+    if (x <= pt[0][0]) return pt[0][1];
+    if (x >= pt[n - 1][0]) return pt[n - 1][1];
+
+    double slope[CURVE_MAX_POINTS];
+    double tangent[CURVE_MAX_POINTS];
+    for (guint i = 0; i + 1 < n; i++) {
+        double dx = pt[i + 1][0] - pt[i][0];
+        slope[i] = dx > 0 ? (pt[i + 1][1] - pt[i][1]) / dx : 0.0;
+    }
+    tangent[0] = slope[0];
+    tangent[n - 1] = slope[n - 2];
+    for (guint i = 1; i + 1 < n; i++)
+        tangent[i] = slope[i - 1] * slope[i] <= 0 ? 0.0 : (slope[i - 1] + slope[i]) / 2;
+    for (guint i = 0; i + 1 < n; i++) {
+        if (slope[i] == 0.0) {
+            tangent[i] = tangent[i + 1] = 0.0;
+            continue;
+        }
+        double a = tangent[i] / slope[i];
+        double b = tangent[i + 1] / slope[i];
+        double h = a * a + b * b;
+        if (h > 9.0) {
+            double t = 3.0 / sqrt(h);
+            tangent[i] = t * a * slope[i];
+            tangent[i + 1] = t * b * slope[i];
+        }
+    }
+
+    guint i = 0;
+    while (i + 2 < n && x > pt[i + 1][0])
+        i++;
+
+    double dx = pt[i + 1][0] - pt[i][0];
+    double t = dx > 0 ? (x - pt[i][0]) / dx : 0.0;
+    double t2 = t * t;
+    double t3 = t2 * t;
+    return (2 * t3 - 3 * t2 + 1) * pt[i][1]
+        + (t3 - 2 * t2 + t) * dx * tangent[i]
+        + (-2 * t3 + 3 * t2) * pt[i + 1][1]
+        + (t3 - t2) * dx * tangent[i + 1];
+}
+
+static
+double channel_curve(const AdjustmentParams *p, double v)
+{
+    switch (p->type) {
+    case ADJUST_LEVELS: {
+        double range = p->in_white - p->in_black;
+        v = range > 0 ? CLAMP((v - p->in_black) / range, 0.0, 1.0) : (v >= p->in_white);
+        v = pow(v, 1.0 / fmax(p->gamma, 0.01));
+        return p->out_black + v * (p->out_white - p->out_black);
+    }
+    case ADJUST_CURVES:
+        return adjustment_curve_eval(p, v);
+    case ADJUST_BRIGHTNESS_CONTRAST:
+        return (v - 0.5) * tan((p->contrast + 1.0) * G_PI / 4.0) + 0.5 + p->brightness;
+    case ADJUST_HUE_SATURATION:
+    case ADJUST_TYPE_COUNT:
+        break;
+    }
+    return v;
+}
+
+static
+guint8 to_byte(double v)
+{
+    return (guint8)lround(CLAMP(v, 0.0, 1.0) * 255);
+}
+
+// Rebuilds the lookup tables; cheap enough to run on every slider step.
+void adjustment_compile(Adjustment *adj)
+{
+    const AdjustmentParams *p = &adj->params;
+
+    for (int i = 0; i < 256; i++)
+        adj->lut[i] = to_byte(channel_curve(p, i / 255.0));
+
+    double shift = p->hue / 360.0 * HUE_LUT_SIZE;
+    for (int i = 0; i < HUE_LUT_SIZE; i++) {
+        long h = lround(i + shift) % HUE_LUT_SIZE;
+        adj->hue_lut[i] = (guint16)(h < 0 ? h + HUE_LUT_SIZE : h);
+    }
+    for (int i = 0; i < 256; i++) {
+        double v = i / 255.0;
+        adj->sat_lut[i] = to_byte(v * (1.0 + p->saturation));
+        adj->val_lut[i] = to_byte(p->lightness >= 0
+            ? v + (1.0 - v) * p->lightness : v * (1.0 + p->lightness));
+    }
+}
+
+// Straight-alpha pixel through the HSV tables.
+static inline
+uint32_t hue_saturation(const Adjustment *adj, uint32_t p)
+{
+    int r = PIXEL_R(p), g = PIXEL_G(p), b = PIXEL_B(p);
+    int max = MAX(r, MAX(g, b));
+    int min = MIN(r, MIN(g, b));
+    int c = max - min;
+    int v = adj->val_lut[max];
+
+    if (c == 0)
+        return PIXEL_PACK(PIXEL_A(p), v, v, v);
+
+    double h6 = max == r ? (double)(g - b) / c
+        : max == g ? 2.0 + (double)(b - r) / c : 4.0 + (double)(r - g) / c;
+    if (h6 < 0) h6 += 6.0;
+
+    int hue = adj->hue_lut[(int)(h6 * (HUE_LUT_SIZE / 6.0)) % HUE_LUT_SIZE];
+    int s = adj->sat_lut[c * 255 / max];
+    double hh = hue * (6.0 / HUE_LUT_SIZE);
+    int sector = (int)hh;
+    double f = hh - sector;
+    int lo = v * (255 - s) / 255;
+    int dn = (int)lround(v * (255 - s * f) / 255);
+    int up = (int)lround(v * (255 - s * (1.0 - f)) / 255);
+
+    switch (sector % 6) {
+    case 0: return PIXEL_PACK(PIXEL_A(p), v, up, lo);
+    case 1: return PIXEL_PACK(PIXEL_A(p), dn, v, lo);
+    case 2: return PIXEL_PACK(PIXEL_A(p), lo, v, up);
+    case 3: return PIXEL_PACK(PIXEL_A(p), lo, dn, v);
+    case 4: return PIXEL_PACK(PIXEL_A(p), up, lo, v);
+    default: return PIXEL_PACK(PIXEL_A(p), v, lo, dn);
+    }
+}
+
+// Adjusts `n` premultiplied pixels in place, mixed with the unadjusted
+// pixels by `opacity`.
+void adjustment_apply(const Adjustment *adj, uint32_t *px, size_t n, double opacity)
+{
+    uint32_t orig[APPLY_CHUNK];
+    uint32_t mix = (uint32_t)lround(CLAMP(opacity, 0.0, 1.0) * 256);
+    const guint8 *lut = adj->lut;
+
+    for (size_t start = 0; start < n; start += APPLY_CHUNK) {
+        size_t len = MIN(n - start, (size_t)APPLY_CHUNK);
+        uint32_t *span = px + start;
+
+        if (mix < 256)
+            memcpy(orig, span, len * sizeof *span);
+        pixel_unpremultiply(span, span, len);
+        if (adj->params.type == ADJUST_HUE_SATURATION) {
+            for (size_t i = 0; i < len; i++)
+                span[i] = hue_saturation(adj, span[i]);
+        } else {
+            for (size_t i = 0; i < len; i++) {
+                uint32_t p = span[i];
+                span[i] = PIXEL_PACK(PIXEL_A(p), lut[PIXEL_R(p)], lut[PIXEL_G(p)], lut[PIXEL_B(p)]);
+            }
+        }
+        pixel_premultiply(span, span, len);
+        if (mix >= 256)
+            continue;
+        // Lerp every byte lane: two channels at a time in a 32-bit word.
+        for (size_t i = 0; i < len; i++) {
+            uint32_t a = orig[i], b = span[i];
+            uint32_t rb = ((a & 0x00ff00ff) * (256 - mix) + (b & 0x00ff00ff) * mix) >> 8;
+            uint32_t ag = (((a >> 8) & 0x00ff00ff) * (256 - mix) + ((b >> 8) & 0x00ff00ff) * mix) >> 8;
+            span[i] = (rb & 0x00ff00ff) | ((ag & 0x00ff00ff) << 8);
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef ADJUSTMENT_H
+    #define ADJUSTMENT_H
+
+#include <gtk/gtk.h>
+#include <stdint.h>
+
+#define CURVE_MAX_POINTS 8
+#define HUE_LUT_SIZE 4096
+
+typedef enum {
+    ADJUST_LEVELS,
+    ADJUST_CURVES,
+    ADJUST_HUE_SATURATION,
+    ADJUST_BRIGHTNESS_CONTRAST,
+    ADJUST_TYPE_COUNT,
+} AdjustmentType;
+
+// User-facing settings, all channel values in [0, 1].
+typedef struct {
+    AdjustmentType type;
+
+    double in_black, in_white, gamma;
+    double out_black, out_white;
+
+    guint n_points; // sorted by x
+    double points[CURVE_MAX_POINTS][2];
+
+    double hue;        // degrees, [-180, 180]
+    double saturation; // [-1, 1]
+    double lightness;  // [-1, 1]
+
+    double brightness; // [-1, 1]
+    double contrast;   // [-1, 1]
+} AdjustmentParams;
+
+// Settings compiled into lookup tables by adjustment_compile(); the
+// compositor only ever reads the tables.
+typedef struct {
+    AdjustmentParams params;
+    guint8 lut[256];
+    guint16 hue_lut[HUE_LUT_SIZE];
+    guint8 sat_lut[256];
+    guint8 val_lut[256];
+} Adjustment;
+
+extern const char *const ADJUSTMENT_NAMES[ADJUST_TYPE_COUNT];
+
+Adjustment *adjustment_new(AdjustmentType type);
+void adjustment_compile(Adjustment *adj);
+double adjustment_curve_eval(const AdjustmentParams *p, double x);
+void adjustment_apply(const Adjustment *adj, uint32_t *px, size_t n, double opacity);
+
+#endif
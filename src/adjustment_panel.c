@@ -0,0 +1,226 @@
+#include <math.h>
+
+#include "adjustment_panel.h"
+#include "app_state.h"
+#include "widgets.h"
+
+#define CURVE_EDITOR_SIZE 200
+#define CURVE_GRAB_RADIUS 8.0
+
+static int dragged_point = -1;
+
+// The widgets edit the settings in place; they are then recorded and
+// applied like any other input.
+static
+void adjustment_changed(AppState *app)
+{
+    Layer *l = app->active_layer;
+    InputEvent ev = {
+        .kind = INPUT_ADJUSTMENT,
+        .params = l->adjustment->params,
+        .opacity = l->opacity
+    };
+
+    recorder_log(app->recorder, &ev);
+    input_dispatch(app, &ev);
+    gtk_widget_queue_draw(app->drawing_area);
+}
+
+static
+void on_param_changed(GtkRange *range, gpointer user_data)
+{
+    AppState *app = user_data;
+    double *value = g_object_get_data(G_OBJECT(range), "param");
+
+    *value = gtk_range_get_value(range);
+    adjustment_changed(app);
+}
+
+static
+void add_slider(AppState *app, const char *label, double *value, double min, double max, double step)
+{
+    GtkWidget *name = gtk_label_new(label);
+    gtk_widget_set_halign(name, GTK_ALIGN_START);
+    gtk_box_pack_start(GTK_BOX(app->adjustment_box), name, FALSE, FALSE, 2);
+
+    GtkWidget *slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, min, max, step);
+    gtk_range_set_value(GTK_RANGE(slider), *value);
+    g_object_set_data(G_OBJECT(slider), "param", value);
+    g_signal_connect(slider, "value-changed", G_CALLBACK(on_param_changed), app);
+    gtk_box_pack_start(GTK_BOX(app->adjustment_box), slider, FALSE, FALSE, 2);
+}
+
+static
+gboolean on_curve_draw(GtkWidget *widget, cairo_t *cr, gpointer user_data)
+{
+    AppState *app = user_data;
+    Adjustment *adj = app->active_layer->adjustment;
+    double w = gtk_widget_get_allocated_width(widget);
+    double h = gtk_widget_get_allocated_height(widget);
+
+    cairo_set_source_rgb(cr, 0.15, 0.15, 0.15);
+    cairo_paint(cr);
+
+    cairo_set_source_rgb(cr, 0.35, 0.35, 0.35);
+    cairo_set_line_width(cr, 1.0);
+    for (int i = 1; i < 4; i++) {
+        cairo_move_to(cr, w * i / 4, 0);
+        cairo_line_to(cr, w * i / 4, h);
+        cairo_move_to(cr, 0, h * i / 4);
+        cairo_line_to(cr, w, h * i / 4);
+    }
+    cairo_stroke(cr);
+
+    cairo_set_source_rgb(cr, 0.9, 0.9, 0.9);
+    for (int i = 0; i < 256; i++)
+        cairo_line_to(cr, w * i / 255, h * (1.0 - adj->lut[i] / 255.0));
+    cairo_stroke(cr);
+
+    for (guint i = 0; i < adj->params.n_points; i++) {
+        cairo_arc(cr, w * adj->params.points[i][0], h * (1.0 - adj->params.points[i][1]),
+            4.0, 0, 2 * M_PI);
+        cairo_fill(cr);
+    }
+    return FALSE;
+}
+
+static
+void curve_to_point(GtkWidget *widget, double wx, double wy, double *x, double *y)
+{
+    *x = CLAMP(wx / gtk_widget_get_allocated_width(widget), 0.0, 1.0);
+    *y = CLAMP(1.0 - wy / gtk_widget_get_allocated_height(widget), 0.0, 1.0);
+}
+
+// Left button grabs the nearest point or inserts a new one, right button
+// removes a point as long as two are left.
+static
+gboolean on_curve_press(GtkWidget *widget, GdkEventButton *event, gpointer user_data)
+{
+    AppState *app = user_data;
+    AdjustmentParams *p = &app->active_layer->adjustment->params;
+    double w = gtk_widget_get_allocated_width(widget);
+    double h = gtk_widget_get_allocated_height(widget);
+    int nearest = -1;
+
+    for (guint i = 0; i < p->n_points; i++) {
+        double d = hypot(event->x - w * p->points[i][0], event->y - h * (1.0 - p->points[i][1]));
+        if (d <= CURVE_GRAB_RADIUS)
+            nearest = (int)i;
+    }
+
+    if (event->button == GDK_BUTTON_SECONDARY) {
+        if (nearest < 0 || p->n_points <= 2)
+            return TRUE;
+        for (guint i = (guint)nearest; i + 1 < p->n_points; i++) {
+            p->points[i][0] = p->points[i + 1][0];
+            p->points[i][1] = p->points[i + 1][1];
+        }
+        p->n_points--;
+    } else if (event->button == GDK_BUTTON_PRIMARY) {
+        if (nearest < 0 && p->n_points < CURVE_MAX_POINTS) {
+            double x, y;
+            guint at = 0;
+            curve_to_point(widget, event->x, event->y, &x, &y);
+            while (at < p->n_points && p->points[at][0] < x)
+                at++;
+            for (guint i = p->n_points; i > at; i--) {
+                p->points[i][0] = p->points[i - 1][0];
+                p->points[i][1] = p->points[i - 1][1];
+            }
+            p->points[at][0] = x;
+            p->points[at][1] = y;
+            p->n_points++;
+            nearest = (int)at;
+        }
+        dragged_point = nearest;
+    }
+    adjustment_changed(app);
+    gtk_widget_queue_draw(widget);
+    return TRUE;
+}
+
+static
+gboolean on_curve_motion(GtkWidget *widget, GdkEventMotion *event, gpointer user_data)
+{
+    AppState *app = user_data;
+    AdjustmentParams *p = &app->active_layer->adjustment->params;
+    double x, y;
+
+    if (dragged_point < 0 || (guint)dragged_point >= p->n_points)
+        return FALSE;
+
+    // Points keep their order on the x axis.
+    curve_to_point(widget, event->x, event->y, &x, &y);
+    if (dragged_point > 0)
+        x = fmax(x, p->points[dragged_point - 1][0] + 0.01);
+    if ((guint)dragged_point + 1 < p->n_points)
+        x = fmin(x, p->points[dragged_point + 1][0] - 0.01);
+    p->points[dragged_point][0] = x;
+    p->points[dragged_point][1] = y;
+
+    adjustment_changed(app);
+    gtk_widget_queue_draw(widget);
+    return TRUE;
+}
+
+static
+gboolean on_curve_release(GtkWidget *widget, GdkEventButton *event, gpointer user_data)
+{
+    dragged_point = -1;
+    return TRUE;
+}
+
+static
+void add_curve_editor(AppState *app)
+{
+    GtkWidget *area = gtk_drawing_area_new();
+
+    gtk_widget_set_size_request(area, CURVE_EDITOR_SIZE, CURVE_EDITOR_SIZE);
+    gtk_widget_add_events(area,
+        GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK | GDK_BUTTON_MOTION_MASK);
+    g_signal_connect(area, "draw", G_CALLBACK(on_curve_draw), app);
+    g_signal_connect(area, "button-press-event", G_CALLBACK(on_curve_press), app);
+    g_signal_connect(area, "motion-notify-event", G_CALLBACK(on_curve_motion), app);
+    g_signal_connect(area, "button-release-event", G_CALLBACK(on_curve_release), app);
+    gtk_box_pack_start(GTK_BOX(app->adjustment_box), area, FALSE, FALSE, 2);
+}
+
+// Rebuilds the settings of the active layer when it is an adjustment layer.
+void adjustment_panel_refresh(AppState *app)
+{
+    Layer *l = app->active_layer;
+
+    dragged_point = -1;
+    if (!app->adjustment_box)
+        return;
+    widgets_clear(app->adjustment_box);
+    if (!l || l->kind != LAYER_KIND_ADJUSTMENT)
+        return;
+
+    AdjustmentParams *p = &l->adjustment->params;
+    switch (p->type) {
+    case ADJUST_LEVELS:
+        add_slider(app, "Input Black", &p->in_black, 0, 1, 0.01);
+        add_slider(app, "Input White", &p->in_white, 0, 1, 0.01);
+        add_slider(app, "Gamma", &p->gamma, 0.1, 10, 0.01);
+        add_slider(app, "Output Black", &p->out_black, 0, 1, 0.01);
+        add_slider(app, "Output White", &p->out_white, 0, 1, 0.01);
+        break;
+    case ADJUST_CURVES:
+        add_curve_editor(app);
+        break;
+    case ADJUST_HUE_SATURATION:
+        add_slider(app, "Hue", &p->hue, -180, 180, 1);
+        add_slider(app, "Saturation", &p->saturation, -1, 1, 0.01);
+        add_slider(app, "Lightness", &p->lightness, -1, 1, 0.01);
+        break;
+    case ADJUST_BRIGHTNESS_CONTRAST:
+        add_slider(app, "Brightness", &p->brightness, -1, 1, 0.01);
+        add_slider(app, "Contrast", &p->contrast, -1, 1, 0.01);
+        break;
+    case ADJUST_TYPE_COUNT:
+        break;
+    }
+    add_slider(app, "Opacity", &l->opacity, 0, 1, 0.01);
+    gtk_widget_show_all(app->adjustment_box);
+}
@@ -0,0 +1,10 @@
+#ifndef ADJUSTMENT_PANEL_H
+    #define ADJUSTMENT_PANEL_H
+
+#include <gtk/gtk.h>
+
+typedef struct AppState AppState;
+
+void adjustment_panel_refresh(AppState *app);
+
+#endif
@@ -0,0 +1,106 @@
+#include "adjustment_panel.h"
+#include "app_state.h"
+#include "histogram_panel.h"
+#include "journal.h"
+#include "layer_panel.h"
+
+// Tools report every rectangle of canvas they painted on through here.
+void app_damage_layer(AppState *app, Layer *l, const cairo_rectangle_int_t *area)
+{
+    layer_damage(l, area);
+    journal_note_damage(app->journal, l, area);
+    histogram_note_damage(app->histograms, l, area);
+    histogram_panel_queue_update(app);
+}
+
+// `l` was added, moved in the tree, shown or hidden, or had its opacity or
+// adjustment settings changed.
+void app_note_structure(AppState *app, Layer *l)
+{
+    journal_note_structure(app->journal);
+    histogram_note_structure(app->histograms, app->layers, l);
+    histogram_panel_queue_update(app);
+}
+
+// Layer panel actions. They run from input_dispatch(), so that live
+// sessions and replays go through the same code, and refresh the panels
+// when there is a window.
+
+// Adds `l` above the active layer and makes it active.
+void app_add_layer(AppState *app, Layer *l)
+{
+    layer_stack_add_above(app->layers, app->active_layer, l);
+    app->active_layer = l;
+    app_note_structure(app, l);
+    layer_panel_refresh(app);
+    adjustment_panel_refresh(app);
+}
+
+void app_import_layer(AppState *app, const char *filename)
+{
+    Layer *l = layer_new_from_file(filename);
+
+    if (!l)
+        return;
+    // Every tool works on the canvas: make it hold the whole image.
+    layer_stack_grow_canvas(app->layers, &l->bounds);
+    app_add_layer(app, l);
+    journal_note_damage(app->journal, l, &l->bounds);
+}
+
+void app_select_layer(AppState *app, Layer *l)
+{
+    if (!l)
+        return;
+    app->active_layer = l;
+    adjustment_panel_refresh(app);
+    histogram_panel_queue_update(app);
+}
+
+void app_set_layer_visible(AppState *app, Layer *l, gboolean visible)
+{
+    if (!l || l->visible == visible)
+        return;
+    l->visible = visible;
+    layer_mark_dirty(l);
+    app_note_structure(app, l);
+    layer_panel_refresh(app);
+}
+
+// Expands the groups holding `l` so its row shows in the layer list.
+static
+void reveal_layer(Layer *l)
+{
+    for (Layer *p = l->parent; p; p = p->parent)
+        p->expanded = TRUE;
+}
+
+void app_move_layer(AppState *app, int delta)
+{
+    Layer *l = app->active_layer;
+
+    if (!l)
+        return;
+    // Both where the layer leaves and where it lands change.
+    app_note_structure(app, l);
+    if (!layer_stack_move(app->layers, l, delta))
+        return;
+    reveal_layer(l);
+    app_note_structure(app, l);
+    layer_panel_refresh(app);
+}
+
+// Only the lookup tables are rebuilt; the next draw recomposites the
+// viewport and whichever group caches contain the adjustment.
+void app_set_adjustment(AppState *app, const AdjustmentParams *params, double opacity)
+{
+    Layer *l = app->active_layer;
+
+    if (!l || l->kind != LAYER_KIND_ADJUSTMENT || l->adjustment->params.type != params->type)
+        return;
+    l->adjustment->params = *params;
+    l->opacity = opacity;
+    adjustment_compile(l->adjustment);
+    layer_mark_dirty(l);
+    app_note_structure(app, l);
+}
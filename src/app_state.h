@@ -4,19 +4,28 @@
     #include <gtk/gtk.h>
     #include <stdbool.h>
 
+    #include "histogram.h"
+    #include "journal.h"
     #include "layer.h"
+    #include "layer_stack.h"
+    #include "recorder.h"
+    #include "replay.h"
     #include "tools.h"
 
 typedef struct AppState {
     GtkWidget *window;
     GtkWidget *drawing_area;
     GtkWidget *layer_list_box;
-    GList *layers;
+    GtkWidget *adjustment_box;
+    GtkWidget *adjustment_type_combo;
+    GtkWidget *histogram_area;
+    LayerStack *layers;
     Layer *active_layer;
 
     Tool *current_tool;
     double brush_radius;
     GdkRGBA brush_color;
+    gboolean sample_merged; // bucket fill reads the visible composite
 
     double pan_x;
     double pan_y;
@@ -25,7 +34,22 @@ typedef struct AppState {
 
     bool is_drawing;
 
+    Recorder *recorder;
+    Replay *replay;
+    Journal *journal;
+    HistogramCache *histograms;
+
     GtkCssProvider *css_provider;
 } AppState;
 
+void app_damage_layer(AppState *app, Layer *l, const cairo_rectangle_int_t *area);
+void app_note_structure(AppState *app, Layer *l);
+
+void app_add_layer(AppState *app, Layer *l);
+void app_import_layer(AppState *app, const char *filename);
+void app_select_layer(AppState *app, Layer *l);
+void app_set_layer_visible(AppState *app, Layer *l, gboolean visible);
+void app_move_layer(AppState *app, int delta);
+void app_set_adjustment(AppState *app, const AdjustmentParams *params, double opacity);
+
 #endif
@@ -0,0 +1,226 @@
+#include <string.h>
+
+#include "histogram.h"
+#include "pixel.h"
+
+// Stale tiles are recounted for at most this long per request, the rest
+// wait for the next one: an adjustment drag marks its whole area stale on
+// every step, which must not stall the frame.
+#define RECOUNT_BUDGET_US 4000
+
+static
+TileHistograms *tile_histograms_new(void)
+{
+    TileHistograms *th = g_new0(TileHistograms, 1);
+
+    th->tiles = g_hash_table_new_full(tile_key_hash, tile_key_equal, g_free, g_free);
+    th->stale = tile_set_new();
+    return th;
+}
+
+static
+void tile_histograms_free(gpointer data)
+{
+    TileHistograms *th = data;
+
+    if (!th) return;
+    g_hash_table_destroy(th->tiles);
+    g_hash_table_destroy(th->stale);
+    g_free(th);
+}
+
+static
+void mark_stale(TileHistograms *th, const cairo_rectangle_int_t *area)
+{
+    if (th)
+        tile_set_add_rect(th->stale, area);
+}
+
+HistogramCache *histogram_cache_new(void)
+{
+    HistogramCache *cache = g_new0(HistogramCache, 1);
+
+    cache->layers = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, tile_histograms_free);
+    cache->scratch = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+        TILE_SIZE, TILE_SIZE);
+    return cache;
+}
+
+void histogram_cache_free(HistogramCache *cache)
+{
+    if (!cache) return;
+    g_hash_table_destroy(cache->layers);
+    tile_histograms_free(cache->composite);
+    cairo_surface_destroy(cache->scratch);
+    g_free(cache);
+}
+
+// Called for every painted area; costs a few hash lookups per touched tile.
+void histogram_note_damage(HistogramCache *cache, Layer *l, const cairo_rectangle_int_t *area)
+{
+    if (!cache) return;
+
+    mark_stale(g_hash_table_lookup(cache->layers, l), area);
+    mark_stale(cache->composite, area);
+}
+
+// `l` was shown, hidden, moved in the tree or had its settings changed:
+// only the composite under its extent changed, the layers' own pixels did
+// not.
+void histogram_note_structure(HistogramCache *cache, const LayerStack *stack, const Layer *l)
+{
+    cairo_rectangle_int_t area;
+
+    if (!cache || !cache->composite) return;
+
+    layer_stack_extent(stack, l, &area);
+    if (layer_stack_clip_to_canvas(stack, &area))
+        mark_stale(cache->composite, &area);
+}
+
+static
+void count_pixels(Histogram *h, const PixelView *view, int x, int y)
+{
+    uint32_t row[TILE_SIZE];
+    PixelSpanIter it;
+    PixelSpan span;
+
+    pixel_span_iter_init(&it, view, x, y, TILE_SIZE, TILE_SIZE);
+    while (pixel_span_next(&it, &span)) {
+        pixel_unpremultiply(row, span.px, (size_t)span.len);
+        for (int i = 0; i < span.len; i++) {
+            uint32_t p = row[i];
+            if (PIXEL_A(p) == 0) continue;
+
+            uint32_t r = PIXEL_R(p), g = PIXEL_G(p), b = PIXEL_B(p);
+            // Rec. 709 luma, weights scaled to sum to 256.
+            h->bins[HISTOGRAM_VALUE][(54 * r + 183 * g + 19 * b + 128) >> 8]++;
+            h->bins[HISTOGRAM_RED][r]++;
+            h->bins[HISTOGRAM_GREEN][g]++;
+            h->bins[HISTOGRAM_BLUE][b]++;
+            h->count++;
+        }
+    }
+}
+
+static
+void histogram_add(Histogram *dst, const Histogram *src, int sign)
+{
+    for (int c = 0; c < HISTOGRAM_CHANNELS; c++)
+        for (int i = 0; i < 256; i++)
+            dst->bins[c][i] += (guint32)sign * src->bins[c][i];
+    dst->count += (guint32)sign * src->count;
+}
+
+// Swaps the old counts of a tile for `fresh` in the running sum.
+static
+void replace_tile(TileHistograms *th, const TileKey *key, const Histogram *fresh)
+{
+    Histogram *old = g_hash_table_lookup(th->tiles, key);
+
+    if (old) {
+        histogram_add(&th->total, old, -1);
+        if (fresh->count == 0) {
+            g_hash_table_remove(th->tiles, key);
+            return;
+        }
+    } else {
+        if (fresh->count == 0)
+            return;
+        old = g_new(Histogram, 1);
+        g_hash_table_insert(th->tiles, g_memdup2(key, sizeof *key), old);
+    }
+    *old = *fresh;
+    histogram_add(&th->total, fresh, 1);
+}
+
+// Recounts stale tiles of `th` with `count` until none is left or the time
+// budget is spent. Returns TRUE if some are left for the next request.
+static
+gboolean recount(TileHistograms *th, void (*count)(Histogram *, const TileKey *, gpointer), gpointer data)
+{
+    gint64 deadline = g_get_monotonic_time() + RECOUNT_BUDGET_US;
+    GHashTableIter iter;
+    gpointer key;
+
+    g_hash_table_iter_init(&iter, th->stale);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        Histogram fresh = { 0 };
+        count(&fresh, key, data);
+        replace_tile(th, key, &fresh);
+        g_hash_table_iter_remove(&iter);
+        if (g_get_monotonic_time() >= deadline)
+            break;
+    }
+    return g_hash_table_size(th->stale) > 0;
+}
+
+static
+void count_layer_tile(Histogram *h, const TileKey *t, gpointer data)
+{
+    Layer *l = data;
+    PixelView view;
+
+    if (l->kind == LAYER_KIND_PIXEL && pixel_view_init(&view, l->surface))
+        count_pixels(h, &view, t->tx * TILE_SIZE - l->x, t->ty * TILE_SIZE - l->y);
+}
+
+// Sets `pending` when stale tiles are left: the sum is then partly outdated
+// and the caller should ask again on the next frame.
+const Histogram *histogram_layer(HistogramCache *cache, Layer *l, gboolean *pending)
+{
+    TileHistograms *th = g_hash_table_lookup(cache->layers, l);
+
+    // First request: count every tile of the layer once.
+    if (!th) {
+        th = tile_histograms_new();
+        g_hash_table_insert(cache->layers, l, th);
+        mark_stale(th, &l->bounds);
+    }
+    *pending = recount(th, count_layer_tile, l);
+    return &th->total;
+}
+
+static
+void count_composite_tile(Histogram *h, const TileKey *t, gpointer data)
+{
+    HistogramCache *cache = data;
+    cairo_rectangle_int_t rect;
+    PixelView view;
+
+    tile_rect(t, &rect);
+    // Tiles hanging over the canvas edge only count the canvas part.
+    if (!layer_stack_clip_to_canvas(cache->stack, &rect))
+        return;
+    layer_stack_render_rect(cache->stack, cache->scratch, &rect);
+    if (pixel_view_init(&view, cache->scratch)) {
+        view.width = rect.width;
+        view.height = rect.height;
+        count_pixels(h, &view, 0, 0);
+    }
+}
+
+const Histogram *histogram_composite(HistogramCache *cache, LayerStack *stack, gboolean *pending)
+{
+    TileHistograms *th = cache->composite;
+
+    if (!th) {
+        th = cache->composite = tile_histograms_new();
+        cache->canvas_width = cache->canvas_height = 0;
+    }
+    // New canvas area, from a first request or an imported image.
+    if (stack->width > cache->canvas_width || stack->height > cache->canvas_height) {
+        cairo_rectangle_int_t right = { cache->canvas_width, 0,
+            stack->width - cache->canvas_width, stack->height };
+        cairo_rectangle_int_t below = { 0, cache->canvas_height,
+            stack->width, stack->height - cache->canvas_height };
+        mark_stale(th, &right);
+        mark_stale(th, &below);
+        cache->canvas_width = stack->width;
+        cache->canvas_height = stack->height;
+    }
+
+    cache->stack = stack;
+    *pending = recount(th, count_composite_tile, cache);
+    return &th->total;
+}
@@ -0,0 +1,51 @@
+#ifndef HISTOGRAM_H
+    #define HISTOGRAM_H
+
+#include <cairo.h>
+#include <gtk/gtk.h>
+
+#include "layer.h"
+#include "layer_stack.h"
+#include "tile.h"
+
+typedef enum {
+    HISTOGRAM_VALUE,
+    HISTOGRAM_RED,
+    HISTOGRAM_GREEN,
+    HISTOGRAM_BLUE,
+    HISTOGRAM_CHANNELS,
+} HistogramChannel;
+
+// Straight-alpha channel counts, fully transparent pixels are left out.
+typedef struct {
+    guint32 bins[HISTOGRAM_CHANNELS][256];
+    guint32 count;
+} Histogram;
+
+// Histograms of the canvas tiles of one image, and their running sum.
+// Damage only marks tiles stale; they are recounted when a sum is read,
+// within a time budget per read.
+typedef struct {
+    GHashTable *tiles; // TileKey -> Histogram
+    GHashTable *stale; // TileKey -> NULL
+    Histogram total;
+} TileHistograms;
+
+typedef struct {
+    GHashTable *layers; // Layer -> TileHistograms
+    TileHistograms *composite;
+    int canvas_width, canvas_height; // covered by the composite tiles
+    LayerStack *stack; // being counted
+    cairo_surface_t *scratch; // one composited tile
+} HistogramCache;
+
+HistogramCache *histogram_cache_new(void);
+void histogram_cache_free(HistogramCache *cache);
+
+void histogram_note_damage(HistogramCache *cache, Layer *l, const cairo_rectangle_int_t *area);
+void histogram_note_structure(HistogramCache *cache, const LayerStack *stack, const Layer *l);
+
+const Histogram *histogram_layer(HistogramCache *cache, Layer *l, gboolean *pending);
+const Histogram *histogram_composite(HistogramCache *cache, LayerStack *stack, gboolean *pending);
+
+#endif
@@ -0,0 +1,107 @@
+#include "app_state.h"
+#include "histogram_panel.h"
+
+#define HISTOGRAM_HEIGHT 100
+
+static const double CHANNEL_COLORS[HISTOGRAM_CHANNELS][3] = {
+    [HISTOGRAM_VALUE] = { 0.8, 0.8, 0.8 },
+    [HISTOGRAM_RED] = { 0.9, 0.2, 0.2 },
+    [HISTOGRAM_GREEN] = { 0.2, 0.8, 0.2 },
+    [HISTOGRAM_BLUE] = { 0.3, 0.4, 1.0 },
+};
+
+static gboolean show_composite = FALSE;
+
+static
+void draw_channel(cairo_t *cr, const Histogram *h, HistogramChannel c, guint32 peak, double w, double ht)
+{
+    cairo_move_to(cr, 0, ht);
+    for (int i = 0; i < 256; i++) {
+        double v = MIN(1.0, (double)h->bins[c][i] / peak);
+        cairo_line_to(cr, w * i / 255, ht * (1.0 - v));
+    }
+    cairo_line_to(cr, w, ht);
+}
+
+// Only runs when GTK draws the panel, which it does at most once per frame
+// however many dabs queued an update; the stale tiles are recounted here.
+static
+gboolean on_histogram_draw(GtkWidget *widget, cairo_t *cr, gpointer user_data)
+{
+    AppState *app = user_data;
+    double w = gtk_widget_get_allocated_width(widget);
+    double ht = gtk_widget_get_allocated_height(widget);
+    Layer *l = app->active_layer;
+    const Histogram *h;
+
+    cairo_set_source_rgb(cr, 0.12, 0.12, 0.12);
+    cairo_paint(cr);
+    if (!app->histograms || !app->layers)
+        return FALSE;
+
+    gboolean pending;
+    if (show_composite || !l || l->kind != LAYER_KIND_PIXEL)
+        h = histogram_composite(app->histograms, app->layers, &pending);
+    else
+        h = histogram_layer(app->histograms, l, &pending);
+    // Large recounts, after an adjustment change, spread over frames.
+    if (pending)
+        gtk_widget_queue_draw(widget);
+    if (h->count == 0)
+        return FALSE;
+
+    // Scale to the tallest value bin so a single flat color does not
+    // squash everything else, letting the RGB peaks clip.
+    guint32 peak = 1;
+    for (int i = 0; i < 256; i++)
+        peak = MAX(peak, h->bins[HISTOGRAM_VALUE][i]);
+
+    const double *gray = CHANNEL_COLORS[HISTOGRAM_VALUE];
+    cairo_set_source_rgba(cr, gray[0], gray[1], gray[2], 0.5);
+    draw_channel(cr, h, HISTOGRAM_VALUE, peak, w, ht);
+    cairo_fill(cr);
+
+    cairo_set_line_width(cr, 1.0);
+    for (int c = HISTOGRAM_RED; c <= HISTOGRAM_BLUE; c++) {
+        cairo_set_source_rgb(cr, CHANNEL_COLORS[c][0], CHANNEL_COLORS[c][1], CHANNEL_COLORS[c][2]);
+        draw_channel(cr, h, (HistogramChannel)c, peak, w, ht);
+        cairo_stroke(cr);
+    }
+    return FALSE;
+}
+
+static
+void on_source_changed(GtkComboBox *combo, gpointer user_data)
+{
+    AppState *app = user_data;
+
+    show_composite = gtk_combo_box_get_active(combo) == 1;
+    histogram_panel_queue_update(app);
+}
+
+GtkWidget *histogram_panel_new(AppState *app)
+{
+    GtkWidget *vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 2);
+
+    GtkWidget *label = gtk_label_new("Histogram");
+    gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, FALSE, 2);
+
+    GtkWidget *source = gtk_combo_box_text_new();
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(source), "Active Layer");
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(source), "Composite");
+    gtk_combo_box_set_active(GTK_COMBO_BOX(source), show_composite);
+    g_signal_connect(source, "changed", G_CALLBACK(on_source_changed), app);
+    gtk_box_pack_start(GTK_BOX(vbox), source, FALSE, FALSE, 2);
+
+    app->histogram_area = gtk_drawing_area_new();
+    gtk_widget_set_size_request(app->histogram_area, -1, HISTOGRAM_HEIGHT);
+    g_signal_connect(app->histogram_area, "draw", G_CALLBACK(on_histogram_draw), app);
+    gtk_box_pack_start(GTK_BOX(vbox), app->histogram_area, FALSE, FALSE, 2);
+    return vbox;
+}
+
+void histogram_panel_queue_update(AppState *app)
+{
+    if (app->histogram_area)
+        gtk_widget_queue_draw(app->histogram_area);
+}
@@ -0,0 +1,11 @@
+#ifndef HISTOGRAM_PANEL_H
+    #define HISTOGRAM_PANEL_H
+
+#include <gtk/gtk.h>
+
+typedef struct AppState AppState;
+
+GtkWidget *histogram_panel_new(AppState *app);
+void histogram_panel_queue_update(AppState *app);
+
+#endif
@@ -0,0 +1,703 @@
+#include <errno.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "journal.h"
+#include "pixel.h"
+
+#define JOURNAL_MAGIC "EGJRNL02"
+#define HEADER_BYTES (sizeof JOURNAL_MAGIC - 1 + 2 * sizeof(gint32))
+#define RECORD_HEADER_BYTES 5
+#define TILE_BYTES (TILE_SIZE * TILE_SIZE * 4)
+
+// At most this many tiles (4 MiB) are copied per flush, and none while the
+// writer still has that many queued: larger backlogs carry over.
+#define FLUSH_MAX_TILES 256
+
+// The log is rewritten with one record per tile once it is this many times
+// larger than those records, and past COMPACT_MIN_BYTES.
+#define COMPACT_RATIO 4
+#define COMPACT_MIN_BYTES (16 << 20)
+
+// Every record is a type byte, a 32-bit payload size and the payload, all
+// in host byte order: the log is only meant to be read back on this machine.
+typedef enum {
+    RECORD_STRUCTURE = 1,
+    RECORD_TILE = 2,
+    RECORD_STOP, // never written, tells the writer thread to exit
+} RecordType;
+
+typedef struct {
+    Layer *layer;
+    TileKey tile;
+} JournalTile;
+
+typedef struct {
+    RecordType type;
+    guint32 layer_id;
+    gint32 tx, ty;
+    GByteArray *data; // layer tree, or raw tile pixels before compression
+} JournalJob;
+
+// Where the writer last logged a tile, by layer id.
+typedef struct {
+    guint32 layer_id;
+    TileKey tile;
+    gint64 offset;
+    guint32 size; // whole record
+} LoggedTile;
+
+// What the writer thread knows of the log: the last structure record and
+// the last record of each tile, which is all a restore needs. Layers are
+// never deleted from the tree, so every logged tile is still live.
+typedef struct {
+    GHashTable *tiles; // LoggedTile
+    GByteArray *structure;
+    gint64 end;  // log size
+    gint64 live; // bytes of the records above
+} LogIndex;
+
+static
+guint journal_tile_hash(gconstpointer key)
+{
+    const JournalTile *t = key;
+
+    return g_direct_hash(t->layer) ^ tile_key_hash(&t->tile);
+}
+
+static
+gboolean journal_tile_equal(gconstpointer a, gconstpointer b)
+{
+    const JournalTile *x = a;
+    const JournalTile *y = b;
+
+    return x->layer == y->layer && tile_key_equal(&x->tile, &y->tile);
+}
+
+static
+guint logged_tile_hash(gconstpointer key)
+{
+    const LoggedTile *t = key;
+
+    return t->layer_id ^ tile_key_hash(&t->tile);
+}
+
+static
+gboolean logged_tile_equal(gconstpointer a, gconstpointer b)
+{
+    const LoggedTile *x = a;
+    const LoggedTile *y = b;
+
+    return x->layer_id == y->layer_id && tile_key_equal(&x->tile, &y->tile);
+}
+
+char *journal_default_path(void)
+{
+    return g_build_filename(g_get_user_cache_dir(), "epi-gimp", "recovery.journal", NULL);
+}
+
+static
+void job_free(JournalJob *job)
+{
+    if (job->data)
+        g_byte_array_free(job->data, TRUE);
+    g_free(job);
+}
+
+static
+gboolean write_record(FILE *file, RecordType type, guint32 size)
+{
+    guint8 tag = (guint8)type;
+
+    return fwrite(&tag, 1, 1, file) == 1 && fwrite(&size, sizeof size, 1, file) == 1;
+}
+
+// Warns once: a full disk would otherwise fail on every record.
+static
+void report_write_error(Journal *journal)
+{
+    if (journal->write_failed)
+        return;
+    journal->write_failed = TRUE;
+    g_warning("Journal: cannot write the recovery log: %s", g_strerror(errno));
+}
+
+// Deflates a tile into `out`, returns the compressed size or 0 on failure.
+static
+gsize compress_tile(GConverter *zip, const guint8 *tile, guint8 *out, gsize out_size)
+{
+    gsize read = 0;
+    gsize written = 0;
+    GError *err = NULL;
+
+    g_converter_reset(zip);
+    GConverterResult res = g_converter_convert(zip, tile, TILE_BYTES, out, out_size,
+        G_CONVERTER_INPUT_AT_END, &read, &written, &err);
+    if (res != G_CONVERTER_FINISHED) {
+        g_warning("Journal: cannot compress tile: %s", err ? err->message : "short buffer");
+        g_clear_error(&err);
+        return 0;
+    }
+    return written;
+}
+
+static
+void log_tile(LogIndex *index, const JournalJob *job, guint32 size)
+{
+    LoggedTile probe = { job->layer_id, { job->tx, job->ty }, 0, 0 };
+    LoggedTile *t = g_hash_table_lookup(index->tiles, &probe);
+
+    if (t) {
+        index->live -= t->size;
+    } else {
+        t = g_memdup2(&probe, sizeof probe);
+        g_hash_table_add(index->tiles, t);
+    }
+    t->offset = index->end;
+    t->size = size;
+    index->live += size;
+}
+
+// Keeps the payload of the structure record `job` just written.
+static
+void log_structure(LogIndex *index, JournalJob *job)
+{
+    if (index->structure) {
+        index->live -= RECORD_HEADER_BYTES + index->structure->len;
+        g_byte_array_free(index->structure, TRUE);
+    }
+    index->structure = job->data;
+    job->data = NULL;
+    index->live += RECORD_HEADER_BYTES + index->structure->len;
+}
+
+static
+gboolean copy_header(FILE *from, FILE *to)
+{
+    guint8 header[HEADER_BYTES];
+
+    return fseek(from, 0, SEEK_SET) == 0 && fread(header, 1, sizeof header, from) == sizeof header
+        && fwrite(header, 1, sizeof header, to) == sizeof header;
+}
+
+// Writes the header, the last structure and the last record of every tile
+// to a new file, then renames it over the log: a crash at any point leaves
+// one complete log behind. Returns FALSE, with the log untouched, on error.
+static
+gboolean compact_log(Journal *journal, LogIndex *index)
+{
+    char *tmp = g_strconcat(journal->path, ".tmp", NULL);
+    FILE *out = fopen(tmp, "w+b");
+    GByteArray *record = g_byte_array_new();
+    gint64 end = HEADER_BYTES;
+    gboolean ok = out && copy_header(journal->file, out);
+
+    if (ok && index->structure) {
+        ok = write_record(out, RECORD_STRUCTURE, index->structure->len)
+            && fwrite(index->structure->data, 1, index->structure->len, out) == index->structure->len;
+        end += RECORD_HEADER_BYTES + index->structure->len;
+    }
+
+    GHashTableIter iter;
+    gpointer key;
+    GArray *moved = g_array_new(FALSE, FALSE, sizeof(gint64));
+    g_hash_table_iter_init(&iter, index->tiles);
+    while (ok && g_hash_table_iter_next(&iter, &key, NULL)) {
+        LoggedTile *t = key;
+        g_byte_array_set_size(record, t->size);
+        ok = fseek(journal->file, (long)t->offset, SEEK_SET) == 0
+            && fread(record->data, 1, t->size, journal->file) == t->size
+            && fwrite(record->data, 1, t->size, out) == t->size;
+        g_array_append_val(moved, end);
+        end += t->size;
+    }
+    ok = ok && fflush(out) == 0 && g_fsync(fileno(out)) == 0
+        && g_rename(tmp, journal->path) == 0;
+
+    if (ok) {
+        // Same iteration order: nothing changed the table since.
+        guint i = 0;
+        g_hash_table_iter_init(&iter, index->tiles);
+        while (g_hash_table_iter_next(&iter, &key, NULL))
+            ((LoggedTile *)key)->offset = g_array_index(moved, gint64, i++);
+        fclose(journal->file);
+        journal->file = out;
+        index->end = end;
+    } else {
+        if (out) {
+            fclose(out);
+            g_remove(tmp);
+        }
+    }
+    // Appends resume at the end of whichever file is the log now.
+    fseek(journal->file, 0, SEEK_END);
+
+    g_array_free(moved, TRUE);
+    g_byte_array_free(record, TRUE);
+    g_free(tmp);
+    return ok;
+}
+
+static
+gpointer journal_writer(gpointer user_data)
+{
+    Journal *journal = user_data;
+    GConverter *zip = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, 1));
+    gsize out_size = TILE_BYTES + TILE_BYTES / 8 + 64;
+    guint8 *out = g_malloc(out_size);
+    LogIndex index = {
+        .tiles = g_hash_table_new_full(logged_tile_hash, logged_tile_equal, g_free, NULL),
+        .end = HEADER_BYTES,
+    };
+    gboolean compact_failed = FALSE;
+
+    for (;;) {
+        JournalJob *job = g_async_queue_pop(journal->queue);
+
+        if (job->type == RECORD_STOP) {
+            job_free(job);
+            break;
+        }
+        gboolean ok = TRUE;
+        if (job->type == RECORD_STRUCTURE) {
+            guint32 len = job->data->len;
+            ok = write_record(journal->file, job->type, len)
+                && fwrite(job->data->data, 1, len, journal->file) == len;
+            if (ok) {
+                log_structure(&index, job);
+                index.end += RECORD_HEADER_BYTES + len;
+            }
+        } else {
+            gsize len = compress_tile(zip, job->data->data, out, out_size);
+            if (len) {
+                guint32 size = (guint32)(12 + len);
+                ok = write_record(journal->file, job->type, size)
+                    && fwrite(&job->layer_id, 4, 1, journal->file) == 1
+                    && fwrite(&job->tx, 4, 1, journal->file) == 1
+                    && fwrite(&job->ty, 4, 1, journal->file) == 1
+                    && fwrite(out, 1, len, journal->file) == len;
+                if (ok) {
+                    log_tile(&index, job, RECORD_HEADER_BYTES + size);
+                    index.end += RECORD_HEADER_BYTES + size;
+                }
+            }
+        }
+        job_free(job);
+        // Hit the disk once the current batch is written, not per record.
+        if (ok && g_async_queue_length(journal->queue) <= 0) {
+            ok = fflush(journal->file) == 0;
+            // Offsets are only known while every write went through.
+            if (ok && !journal->write_failed && !compact_failed
+                && index.end > COMPACT_MIN_BYTES && index.end > COMPACT_RATIO * index.live
+                && !compact_log(journal, &index)) {
+                g_warning("Journal: cannot compact the recovery log: %s", g_strerror(errno));
+                compact_failed = TRUE;
+            }
+        }
+        if (!ok)
+            report_write_error(journal);
+    }
+
+    if (fflush(journal->file) != 0)
+        report_write_error(journal);
+    g_hash_table_destroy(index.tiles);
+    if (index.structure)
+        g_byte_array_free(index.structure, TRUE);
+    g_free(out);
+    g_object_unref(zip);
+    return NULL;
+}
+
+// Truncates `filename` and starts the writer thread.
+Journal *journal_open(const char *filename, const LayerStack *stack, GError **err)
+{
+    char *dir = g_path_get_dirname(filename);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    // Read back by compaction.
+    FILE *file = fopen(filename, "w+b");
+    if (!file) {
+        g_set_error(err, G_FILE_ERROR, g_file_error_from_errno(errno),
+            "Cannot open '%s': %s", filename, g_strerror(errno));
+        return NULL;
+    }
+
+    gint32 size[2] = { stack->width, stack->height };
+    fwrite(JOURNAL_MAGIC, 1, strlen(JOURNAL_MAGIC), file);
+    fwrite(size, sizeof size, 1, file);
+
+    Journal *journal = g_new0(Journal, 1);
+    journal->path = g_strdup(filename);
+    journal->file = file;
+    journal->queue = g_async_queue_new();
+    journal->dirty = g_hash_table_new_full(journal_tile_hash, journal_tile_equal, g_free, NULL);
+    journal->writer = g_thread_new("journal", journal_writer, journal);
+    return journal;
+}
+
+// Called for every painted area: only remembers which tiles to save.
+void journal_note_damage(Journal *journal, Layer *l, const cairo_rectangle_int_t *area)
+{
+    if (!journal || !l || area->width <= 0 || area->height <= 0)
+        return;
+
+    TileIter it;
+    JournalTile key = { l, { 0, 0 } };
+
+    tile_iter_init(&it, area);
+    while (tile_iter_next(&it, &key.tile))
+        if (!g_hash_table_contains(journal->dirty, &key))
+            g_hash_table_add(journal->dirty, g_memdup2(&key, sizeof key));
+}
+
+void journal_note_structure(Journal *journal)
+{
+    if (journal)
+        journal->structure_dirty = TRUE;
+}
+
+// Queues every layer below `group` for a full snapshot.
+void journal_note_stack(Journal *journal, Layer *group)
+{
+    if (!journal) return;
+
+    journal->structure_dirty = TRUE;
+    for (guint i = 0; i < group->children->len; i++) {
+        Layer *l = g_ptr_array_index(group->children, i);
+        if (l->kind == LAYER_KIND_GROUP)
+            journal_note_stack(journal, l);
+        else
+            journal_note_damage(journal, l, &l->bounds);
+    }
+}
+
+static
+void append_layer_tree(GByteArray *out, Layer *group)
+{
+    for (guint i = 0; i < group->children->len; i++) {
+        Layer *l = g_ptr_array_index(group->children, i);
+        guint32 parent = group->parent ? group->id : 0;
+        guint16 name_len = (guint16)MIN(strlen(l->name), G_MAXUINT16);
+        guint8 flags[2] = { (guint8)l->kind, (guint8)(l->visible != FALSE) };
+
+        g_byte_array_append(out, (const guint8 *)&l->id, 4);
+        g_byte_array_append(out, (const guint8 *)&parent, 4);
+        g_byte_array_append(out, flags, 2);
+        g_byte_array_append(out, (const guint8 *)&l->opacity, sizeof l->opacity);
+        g_byte_array_append(out, (const guint8 *)&name_len, 2);
+        g_byte_array_append(out, (const guint8 *)l->name, name_len);
+        if (l->kind == LAYER_KIND_ADJUSTMENT)
+            g_byte_array_append(out, (const guint8 *)&l->adjustment->params,
+                sizeof l->adjustment->params);
+        if (l->kind == LAYER_KIND_GROUP)
+            append_layer_tree(out, l);
+    }
+}
+
+// Copies one tile of the layer, transparent where it has no surface.
+static
+GByteArray *snapshot_tile(Layer *l, const TileKey *tile)
+{
+    GByteArray *data = g_byte_array_sized_new(TILE_BYTES);
+    PixelView view;
+
+    g_byte_array_set_size(data, TILE_BYTES);
+    memset(data->data, 0, TILE_BYTES);
+    if (!pixel_view_init(&view, l->surface))
+        return data;
+
+    int ox = tile->tx * TILE_SIZE - l->x;
+    int oy = tile->ty * TILE_SIZE - l->y;
+    PixelSpanIter it;
+    PixelSpan span;
+
+    pixel_span_iter_init(&it, &view, ox, oy, TILE_SIZE, TILE_SIZE);
+    while (pixel_span_next(&it, &span)) {
+        guint8 *dst = data->data + ((span.y - oy) * TILE_SIZE + (span.x - ox)) * 4;
+        memcpy(dst, span.px, (size_t)span.len * 4);
+    }
+    return data;
+}
+
+static
+void queue_tile(Journal *journal, const JournalTile *tile)
+{
+    JournalJob *job = g_new0(JournalJob, 1);
+
+    job->type = RECORD_TILE;
+    job->layer_id = tile->layer->id;
+    job->tx = tile->tile.tx;
+    job->ty = tile->tile.ty;
+    job->data = snapshot_tile(tile->layer, &tile->tile);
+    g_async_queue_push(journal->queue, job);
+}
+
+// Hands the layer tree (if it changed) and up to FLUSH_MAX_TILES dirty
+// tiles to the writer. The tiles are copied here so painting may resume
+// immediately. Returns TRUE if dirty tiles are left for a later flush.
+gboolean journal_flush(Journal *journal, LayerStack *stack)
+{
+    if (!journal) return FALSE;
+
+    if (journal->structure_dirty) {
+        JournalJob *job = g_new0(JournalJob, 1);
+        job->type = RECORD_STRUCTURE;
+        job->data = g_byte_array_new();
+        // The canvas grows when a larger image is imported.
+        gint32 size[2] = { stack->width, stack->height };
+        g_byte_array_append(job->data, (const guint8 *)size, sizeof size);
+        append_layer_tree(job->data, stack->root);
+        g_async_queue_push(journal->queue, job);
+        journal->structure_dirty = FALSE;
+    }
+
+    gint budget = FLUSH_MAX_TILES - g_async_queue_length(journal->queue);
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, journal->dirty);
+    while (budget-- > 0 && g_hash_table_iter_next(&iter, &key, NULL)) {
+        queue_tile(journal, key);
+        g_hash_table_iter_remove(&iter);
+    }
+    return g_hash_table_size(journal->dirty) > 0;
+}
+
+// Waits for pending records to reach the disk. The log is kept: there is no
+// other copy of the document to fall back on.
+void journal_close(Journal *journal)
+{
+    if (!journal) return;
+
+    // Whatever is left goes out now, regardless of the per-flush cap.
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, journal->dirty);
+    while (g_hash_table_iter_next(&iter, &key, NULL))
+        queue_tile(journal, key);
+
+    JournalJob *stop = g_new0(JournalJob, 1);
+    stop->type = RECORD_STOP;
+    g_async_queue_push(journal->queue, stop);
+    g_thread_join(journal->writer);
+
+    g_async_queue_unref(journal->queue);
+    g_hash_table_destroy(journal->dirty);
+    fclose(journal->file);
+    g_free(journal->path);
+    g_free(journal);
+}
+
+static
+gboolean read_exact(FILE *file, void *buf, size_t size)
+{
+    return fread(buf, 1, size, file) == size;
+}
+
+// Rebuilds the tree from a structure record, reusing layers by id.
+static
+gboolean apply_structure(LayerStack *stack, GHashTable *layers, const guint8 *p, const guint8 *end)
+{
+    GHashTableIter iter;
+    gpointer value;
+    gint32 size[2];
+
+    if (end - p < (ptrdiff_t)sizeof size) return FALSE;
+    memcpy(size, p, sizeof size);
+    p += sizeof size;
+    if (size[0] <= 0 || size[1] <= 0) return FALSE;
+    stack->width = size[0];
+    stack->height = size[1];
+
+    g_hash_table_iter_init(&iter, layers);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        Layer *l = value;
+        l->parent = NULL;
+        if (l->children)
+            g_ptr_array_set_size(l->children, 0);
+    }
+    g_ptr_array_set_size(stack->root->children, 0);
+
+    while (p < end) {
+        guint32 id, parent_id;
+        guint8 flags[2];
+        double opacity;
+        guint16 name_len;
+
+        if (end - p < 20) return FALSE;
+        memcpy(&id, p, 4);
+        memcpy(&parent_id, p + 4, 4);
+        memcpy(flags, p + 8, 2);
+        memcpy(&opacity, p + 10, 8);
+        memcpy(&name_len, p + 18, 2);
+        p += 20;
+        if (end - p < name_len) return FALSE;
+
+        char *name = g_strndup((const char *)p, name_len);
+        p += name_len;
+
+        AdjustmentParams params = { 0 };
+        if (flags[0] == LAYER_KIND_ADJUSTMENT) {
+            if ((gsize)(end - p) < sizeof params) {
+                g_free(name);
+                return FALSE;
+            }
+            memcpy(&params, p, sizeof params);
+            p += sizeof params;
+            if ((guint)params.type >= ADJUST_TYPE_COUNT || params.n_points > CURVE_MAX_POINTS) {
+                g_free(name);
+                return FALSE;
+            }
+        }
+
+        Layer *l = g_hash_table_lookup(layers, GUINT_TO_POINTER(id));
+        if (!l) {
+            if (flags[0] == LAYER_KIND_GROUP)
+                l = layer_new_group(name);
+            else if (flags[0] == LAYER_KIND_ADJUSTMENT)
+                l = layer_new_adjustment(params.type);
+            else
+                l = layer_new_empty(name);
+            layer_set_id(l, id);
+            g_hash_table_insert(layers, GUINT_TO_POINTER(id), l);
+        }
+        if (l->kind == LAYER_KIND_ADJUSTMENT && flags[0] == LAYER_KIND_ADJUSTMENT) {
+            l->adjustment->params = params;
+            adjustment_compile(l->adjustment);
+        }
+        g_free(l->name);
+        l->name = name;
+        l->visible = flags[1];
+        l->opacity = opacity;
+
+        Layer *parent = parent_id ? g_hash_table_lookup(layers, GUINT_TO_POINTER(parent_id)) : stack->root;
+        if (!parent || parent->kind != LAYER_KIND_GROUP) return FALSE;
+        layer_stack_insert(stack, parent, parent->children->len, l);
+    }
+    return TRUE;
+}
+
+static
+gboolean tile_is_clear(const guint8 *tile)
+{
+    for (gsize i = 0; i < TILE_BYTES; i++)
+        if (tile[i])
+            return FALSE;
+    return TRUE;
+}
+
+static
+void apply_tile(GHashTable *layers, GConverter *unzip, const guint8 *p, gsize size, guint8 *tile)
+{
+    guint32 id;
+    TileKey key;
+    cairo_rectangle_int_t area;
+    gsize read = 0;
+    gsize written = 0;
+
+    memcpy(&id, p, 4);
+    memcpy(&key.tx, p + 4, 4);
+    memcpy(&key.ty, p + 8, 4);
+
+    Layer *l = g_hash_table_lookup(layers, GUINT_TO_POINTER(id));
+    if (!layer_is_paintable(l))
+        return;
+
+    g_converter_reset(unzip);
+    if (g_converter_convert(unzip, p + 12, size - 12, tile, TILE_BYTES,
+            G_CONVERTER_INPUT_AT_END, &read, &written, NULL) != G_CONVERTER_FINISHED
+        || written != TILE_BYTES)
+        return;
+
+    tile_rect(&key, &area);
+    if (!l->surface && tile_is_clear(tile))
+        return; // nothing to allocate a surface for
+    if (!layer_ensure_rect(l, &area))
+        return;
+
+    int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, TILE_SIZE);
+    cairo_surface_t *src = cairo_image_surface_create_for_data(tile, CAIRO_FORMAT_ARGB32,
+        TILE_SIZE, TILE_SIZE, stride);
+    cairo_t *cr = cairo_create(l->surface);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface(cr, src, area.x - l->x, area.y - l->y);
+    cairo_rectangle(cr, area.x - l->x, area.y - l->y, area.width, area.height);
+    cairo_fill(cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(src);
+    layer_damage(l, &area);
+}
+
+static
+void crop_all(Layer *group)
+{
+    for (guint i = 0; i < group->children->len; i++) {
+        Layer *l = g_ptr_array_index(group->children, i);
+        if (l->kind == LAYER_KIND_GROUP)
+            crop_all(l);
+        else
+            layer_autocrop(l);
+    }
+}
+
+// Replays the log into a new stack. Records are applied in order so later
+// tiles overwrite earlier ones; a truncated last record is ignored.
+LayerStack *journal_restore(const char *filename, GError **err)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        g_set_error(err, G_FILE_ERROR, g_file_error_from_errno(errno),
+            "Cannot open '%s': %s", filename, g_strerror(errno));
+        return NULL;
+    }
+
+    char magic[sizeof JOURNAL_MAGIC - 1];
+    gint32 size[2];
+    if (!read_exact(file, magic, sizeof magic) || memcmp(magic, JOURNAL_MAGIC, sizeof magic) != 0
+        || !read_exact(file, size, sizeof size) || size[0] <= 0 || size[1] <= 0) {
+        g_set_error(err, G_FILE_ERROR, G_FILE_ERROR_INVAL, "'%s' is not a recovery journal", filename);
+        fclose(file);
+        return NULL;
+    }
+
+    LayerStack *stack = layer_stack_new(size[0], size[1]);
+    GHashTable *layers = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GConverter *unzip = G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW));
+    guint8 *tile = g_malloc(TILE_BYTES);
+    GByteArray *payload = g_byte_array_new();
+    guint8 tag;
+    guint32 len;
+
+    while (read_exact(file, &tag, 1) && read_exact(file, &len, sizeof len)) {
+        g_byte_array_set_size(payload, len);
+        if (!read_exact(file, payload->data, len))
+            break;
+        if (tag == RECORD_STRUCTURE
+            && !apply_structure(stack, layers, payload->data, payload->data + len))
+            break;
+        if (tag == RECORD_TILE && len > 12)
+            apply_tile(layers, unzip, payload->data, len, tile);
+    }
+
+    // Layers dropped from the last recorded tree are not part of the stack.
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, layers);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        Layer *l = value;
+        if (!l->parent) {
+            if (l->children)
+                g_ptr_array_set_size(l->children, 0);
+            layer_free(l);
+        }
+    }
+    crop_all(stack->root);
+
+    g_byte_array_free(payload, TRUE);
+    g_free(tile);
+    g_object_unref(unzip);
+    g_hash_table_destroy(layers);
+    fclose(file);
+    return stack;
+}
@@ -0,0 +1,37 @@
+#ifndef JOURNAL_H
+    #define JOURNAL_H
+
+#include <cairo.h>
+#include <gtk/gtk.h>
+#include <stdio.h>
+
+#include "layer.h"
+#include "layer_stack.h"
+#include "tile.h"
+
+// Crash-recovery log. The UI thread only records which tiles changed and,
+// on journal_flush(), copies them out; compression and disk writes happen
+// on a background thread appending to the log. The same thread compacts
+// the log once most of it holds overwritten tiles.
+typedef struct {
+    char *path;
+    FILE *file; // owned by the writer thread until journal_close()
+    GThread *writer;
+    GAsyncQueue *queue;
+    GHashTable *dirty; // JournalTile -> NULL
+    gboolean structure_dirty;
+    gboolean write_failed; // set by the writer thread, warns only once
+} Journal;
+
+char *journal_default_path(void);
+
+Journal *journal_open(const char *filename, const LayerStack *stack, GError **err);
+void journal_note_damage(Journal *journal, Layer *l, const cairo_rectangle_int_t *area);
+void journal_note_structure(Journal *journal);
+void journal_note_stack(Journal *journal, Layer *group);
+gboolean journal_flush(Journal *journal, LayerStack *stack);
+void journal_close(Journal *journal);
+
+LayerStack *journal_restore(const char *filename, GError **err);
+
+#endif
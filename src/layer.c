@@ -1,4 +1,8 @@
 #include "layer.h"
+#include "pixel.h"
+#include "tile.h"
+
+static guint next_layer_id = 1;
 
 static
 cairo_surface_t *create_surface(int w, int h)
@@ -17,8 +21,46 @@ cairo_surface_t *create_surface(int w, int h)
 Layer *layer_new_blank(const char *name, int w, int h)
 {
     Layer *l = g_new0(Layer, 1);
+    l->id = next_layer_id++;
     l->name = g_strdup(name ? name : "Layer");
     l->surface = create_surface(w, h);
+    l->bounds = (cairo_rectangle_int_t){ 0, 0, w, h };
+    l->visible = TRUE;
+    l->opacity = 1.0;
+    return l;
+}
+
+// A pixel layer without any surface, allocated on first paint.
+Layer *layer_new_empty(const char *name)
+{
+    Layer *l = g_new0(Layer, 1);
+    l->id = next_layer_id++;
+    l->name = g_strdup(name ? name : "Layer");
+    l->visible = TRUE;
+    l->opacity = 1.0;
+    return l;
+}
+
+Layer *layer_new_group(const char *name)
+{
+    Layer *l = g_new0(Layer, 1);
+    l->id = next_layer_id++;
+    l->name = g_strdup(name ? name : "Group");
+    l->kind = LAYER_KIND_GROUP;
+    l->children = g_ptr_array_new();
+    l->visible = TRUE;
+    l->opacity = 1.0;
+    l->expanded = TRUE;
+    return l;
+}
+
+Layer *layer_new_adjustment(AdjustmentType type)
+{
+    Layer *l = g_new0(Layer, 1);
+    l->id = next_layer_id++;
+    l->name = g_strdup(ADJUSTMENT_NAMES[type]);
+    l->kind = LAYER_KIND_ADJUSTMENT;
+    l->adjustment = adjustment_new(type);
     l->visible = TRUE;
     l->opacity = 1.0;
     return l;
@@ -37,6 +79,7 @@ Layer *layer_new_from_file(const char *filename)
     int w = gdk_pixbuf_get_width(pix);
     int h = gdk_pixbuf_get_height(pix);
     Layer *l = g_new0(Layer, 1);
+    l->id = next_layer_id++;
     l->name = g_path_get_basename(filename);
     l->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
 
@@ -46,15 +89,236 @@ Layer *layer_new_from_file(const char *filename)
     cairo_destroy(cr);
 
     g_object_unref(pix);
+    l->bounds = (cairo_rectangle_int_t){ 0, 0, w, h };
     l->visible = TRUE;
     l->opacity = 1.0;
+    layer_autocrop(l);
     return l;
 }
 
+// Gives `l` an id read back from a saved document, later layers never reuse it.
+void layer_set_id(Layer *l, guint id)
+{
+    l->id = id;
+    if (id >= next_layer_id)
+        next_layer_id = id + 1;
+}
+
+gboolean layer_is_paintable(const Layer *l)
+{
+    return l && l->kind == LAYER_KIND_PIXEL && !l->locked;
+}
+
+// Grows the surface so that it covers `area` (canvas coordinates), keeping
+// existing pixels in place. Returns FALSE if there is no surface to paint on.
+gboolean layer_ensure_rect(Layer *l, const cairo_rectangle_int_t *area)
+{
+    if (!layer_is_paintable(l) || area->width <= 0 || area->height <= 0)
+        return FALSE;
+
+    int w = l->surface ? cairo_image_surface_get_width(l->surface) : 0;
+    int h = l->surface ? cairo_image_surface_get_height(l->surface) : 0;
+
+    if (l->surface && area->x >= l->x && area->y >= l->y
+        && area->x + area->width <= l->x + w && area->y + area->height <= l->y + h)
+        return TRUE;
+
+    // Whole tiles, so a stroke leaving the layer does not reallocate it on
+    // every dab.
+    int x0 = tile_align_down(area->x);
+    int y0 = tile_align_down(area->y);
+    int x1 = tile_align_down(area->x + area->width + TILE_SIZE - 1);
+    int y1 = tile_align_down(area->y + area->height + TILE_SIZE - 1);
+
+    if (l->surface) {
+        x0 = MIN(x0, l->x);
+        y0 = MIN(y0, l->y);
+        x1 = MAX(x1, l->x + w);
+        y1 = MAX(y1, l->y + h);
+    }
+
+    cairo_surface_t *grown = create_surface(x1 - x0, y1 - y0);
+    if (cairo_surface_status(grown) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(grown);
+        return FALSE;
+    }
+    if (l->surface) {
+        cairo_t *cr = cairo_create(grown);
+        cairo_set_source_surface(cr, l->surface, l->x - x0, l->y - y0);
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        cairo_paint(cr);
+        cairo_destroy(cr);
+        cairo_surface_destroy(l->surface);
+    }
+    l->surface = grown;
+    l->x = x0;
+    l->y = y0;
+    return TRUE;
+}
+
+// Records that `area` (canvas coordinates) of the layer surface changed,
+// growing the content bounds to include it.
+void layer_damage(Layer *l, const cairo_rectangle_int_t *area)
+{
+    cairo_rectangle_int_t extents;
+    cairo_rectangle_int_t painted;
+
+    if (!layer_is_paintable(l) || !l->surface)
+        return;
+
+    // The whole area, as pixels may have left it when the layer moved.
+    layer_mark_dirty_rect(l, area);
+    extents = (cairo_rectangle_int_t){ l->x, l->y,
+        cairo_image_surface_get_width(l->surface),
+        cairo_image_surface_get_height(l->surface) };
+    if (!gdk_rectangle_intersect(area, &extents, &painted))
+        return;
+
+    if (l->proxy) {
+        cairo_surface_destroy(l->proxy);
+        l->proxy = NULL;
+    }
+    if (l->bounds.width <= 0 || l->bounds.height <= 0)
+        l->bounds = painted;
+    else
+        gdk_rectangle_union(&l->bounds, &painted, &l->bounds);
+}
+
+static
+gboolean row_is_clear(const uint32_t *row, int from, int to)
+{
+    for (int x = from; x < to; x++)
+        if (PIXEL_A(row[x]))
+            return FALSE;
+    return TRUE;
+}
+
+// Shrinks the surface to the smallest rectangle holding non-transparent
+// pixels, dropping it entirely when nothing is left.
+void layer_autocrop(Layer *l)
+{
+    PixelView view;
+    cairo_rectangle_int_t before = l->bounds;
+
+    if (!layer_is_paintable(l) || !pixel_view_init(&view, l->surface))
+        return;
+
+    int top = 0;
+    int bottom = view.height;
+    while (top < bottom && row_is_clear(pixel_row(&view, top), 0, view.width))
+        top++;
+    while (bottom > top && row_is_clear(pixel_row(&view, bottom - 1), 0, view.width))
+        bottom--;
+
+    if (top == bottom) {
+        cairo_surface_destroy(l->surface);
+        l->surface = NULL;
+        l->bounds = (cairo_rectangle_int_t){ 0, 0, 0, 0 };
+        layer_mark_dirty_rect(l, &before);
+        return;
+    }
+
+    int left = view.width;
+    int right = 0;
+    for (int y = top; y < bottom; y++) {
+        const uint32_t *row = pixel_row(&view, y);
+        int x = 0;
+        while (x < left && !PIXEL_A(row[x]))
+            x++;
+        left = x;
+        x = view.width;
+        while (x > right && !PIXEL_A(row[x - 1]))
+            x--;
+        right = x;
+    }
+
+    // Only transparent pixels go, the groups holding the layer just have
+    // their bounds and the area the layer covered refreshed.
+    int w = right - left;
+    int h = bottom - top;
+    if (w != view.width || h != view.height) {
+        cairo_surface_t *cropped = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+        cairo_t *cr = cairo_create(cropped);
+        cairo_set_source_surface(cr, l->surface, -left, -top);
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        cairo_paint(cr);
+        cairo_destroy(cr);
+        cairo_surface_destroy(l->surface);
+        l->surface = cropped;
+        l->x += left;
+        l->y += top;
+        layer_mark_dirty_rect(l, &before);
+    }
+    l->bounds = (cairo_rectangle_int_t){ l->x, l->y, w, h };
+}
+
+// Autocrops `l` after `area` (canvas coordinates) was cleared. Clearing
+// pixels can only shrink the content if the area reaches the edge of the
+// content bounds, so the surface is not scanned otherwise.
+void layer_crop_cleared(Layer *l, const cairo_rectangle_int_t *area)
+{
+    const cairo_rectangle_int_t *b = &l->bounds;
+
+    if (!layer_is_paintable(l) || area->width <= 0 || area->height <= 0)
+        return;
+    if (area->x <= b->x || area->y <= b->y
+        || area->x + area->width >= b->x + b->width
+        || area->y + area->height >= b->y + b->height)
+        layer_autocrop(l);
+}
+
+// Drop the cached composite of every group containing `l`.
+void layer_mark_dirty(Layer *l)
+{
+    for (Layer *g = l ? l->parent : NULL; g != NULL; g = g->parent)
+        g->cache_valid = FALSE;
+}
+
+// Only `area` (canvas coordinates) of `l` changed: the groups containing it
+// keep their cached composite and redraw the tiles under `area`.
+void layer_mark_dirty_rect(Layer *l, const cairo_rectangle_int_t *area)
+{
+    if (area->width <= 0 || area->height <= 0)
+        return;
+
+    int x0 = tile_align_down(area->x);
+    int y0 = tile_align_down(area->y);
+    cairo_rectangle_int_t tiles = { x0, y0,
+        tile_align_down(area->x + area->width + TILE_SIZE - 1) - x0,
+        tile_align_down(area->y + area->height + TILE_SIZE - 1) - y0 };
+
+    for (Layer *g = l ? l->parent : NULL; g != NULL; g = g->parent) {
+        // Invalid caches are redrawn whole anyway.
+        if (!g->cache_valid)
+            continue;
+        if (!g->cache_dirty)
+            g->cache_dirty = cairo_region_create();
+        cairo_region_union_rectangle(g->cache_dirty, &tiles);
+    }
+}
+
+guint layer_depth(const Layer *l)
+{
+    guint depth = 0;
+
+    for (const Layer *p = l->parent; p != NULL && p->parent != NULL; p = p->parent)
+        depth++;
+    return depth;
+}
+
 void layer_free(Layer *l)
 {
     if (!l) return;
+    if (l->children) {
+        for (guint i = 0; i < l->children->len; i++)
+            layer_free(g_ptr_array_index(l->children, i));
+        g_ptr_array_free(l->children, TRUE);
+    }
     if (l->name) g_free(l->name);
     if (l->surface) cairo_surface_destroy(l->surface);
+    if (l->cache) cairo_surface_destroy(l->cache);
+    if (l->cache_dirty) cairo_region_destroy(l->cache_dirty);
+    if (l->proxy) cairo_surface_destroy(l->proxy);
+    g_free(l->adjustment);
     g_free(l);
 }
@@ -4,15 +4,64 @@
 #include <cairo.h>
 #include <gtk/gtk.h>
 
-typedef struct {
+#include "adjustment.h"
+
+typedef enum {
+    LAYER_KIND_PIXEL,
+    LAYER_KIND_GROUP,
+    LAYER_KIND_ADJUSTMENT,
+} LayerKind;
+
+typedef struct Layer {
+    guint id; // unique within the session, identifies the layer in journals
     char *name;
+    LayerKind kind;
     cairo_surface_t *surface;
+    int x, y; // canvas position of the surface (or group cache) origin
+    cairo_rectangle_int_t bounds; // canvas area holding content, may be empty
     gboolean visible;
     double opacity;
+
+    // While a transform is previewed (`locked`) the compositor draws `proxy`
+    // through `preview` (proxy pixels to canvas) instead of the surface, and
+    // tools leave the layer alone until the result replaces the surface.
+    // The proxy is a downscaled copy of `proxy_rect`, kept between
+    // transforms and dropped when the layer is painted on.
+    cairo_surface_t *proxy;
+    cairo_rectangle_int_t proxy_rect;
+    cairo_matrix_t preview;
+    gboolean locked;
+
+    struct Layer *parent;
+    guint index; // position inside parent->children
+
+    // Groups only: children from bottom to top and their cached composite.
+    // A valid cache is redrawn only over `cache_dirty` (canvas coordinates,
+    // whole tiles), NULL when nothing changed.
+    GPtrArray *children;
+    cairo_surface_t *cache;
+    gboolean cache_valid;
+    cairo_region_t *cache_dirty;
+    gboolean expanded;
+
+    // Adjustment layers only: applied to what lies below, inside the parent.
+    Adjustment *adjustment;
 } Layer;
 
 Layer *layer_new_blank(const char *name, int w, int h);
 Layer *layer_new_from_file(const char *filename);
+Layer *layer_new_empty(const char *name);
+Layer *layer_new_group(const char *name);
+Layer *layer_new_adjustment(AdjustmentType type);
+void layer_set_id(Layer *l, guint id);
+gboolean layer_is_paintable(const Layer *l);
+gboolean layer_ensure_rect(Layer *l, const cairo_rectangle_int_t *area);
+void layer_damage(Layer *l, const cairo_rectangle_int_t *area);
+void layer_autocrop(Layer *l);
+void layer_crop_cleared(Layer *l, const cairo_rectangle_int_t *area);
+void layer_mark_dirty(Layer *l);
+void layer_mark_dirty_rect(Layer *l, const cairo_rectangle_int_t *area);
+guint layer_depth(const Layer *l);
 void layer_free(Layer *l);
 
 #endif
@@ -0,0 +1,87 @@
+#include "app_state.h"
+#include "layer_panel.h"
+#include "recorder.h"
+#include "widgets.h"
+
+static
+void on_layer_visibility_toggled(GtkToggleButton *toggle, gpointer user_data)
+{
+    Layer *l = user_data;
+    AppState *app = g_object_get_data(G_OBJECT(toggle), "appstate");
+    InputEvent ev = {
+        .kind = INPUT_VISIBILITY,
+        .layer_id = l->id,
+        .enabled = gtk_toggle_button_get_active(toggle)
+    };
+
+    recorder_log(app->recorder, &ev);
+    input_dispatch(app, &ev);
+    gtk_widget_queue_draw(app->drawing_area);
+}
+
+static
+void on_group_expand_clicked(GtkButton *btn, gpointer user_data)
+{
+    Layer *group = user_data;
+    AppState *app = g_object_get_data(G_OBJECT(btn), "appstate");
+
+    group->expanded = !group->expanded;
+    layer_panel_refresh(app);
+}
+
+static
+GtkWidget *create_layer_row(AppState *app, Layer *l)
+{
+    GtkWidget *hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
+    gtk_widget_set_margin_start(hbox, 16 * (int)layer_depth(l));
+
+    if (l->kind == LAYER_KIND_GROUP) {
+        GtkWidget *expand = gtk_button_new_with_label(l->expanded ? "-" : "+");
+        g_object_set_data(G_OBJECT(expand), "appstate", app);
+        g_signal_connect(expand, "clicked", G_CALLBACK(on_group_expand_clicked), l);
+        gtk_box_pack_start(GTK_BOX(hbox), expand, FALSE, FALSE, 2);
+    }
+
+    GtkWidget *visible = gtk_check_button_new();
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(visible), l->visible);
+    g_object_set_data(G_OBJECT(visible), "appstate", app);
+    g_signal_connect(visible, "toggled", G_CALLBACK(on_layer_visibility_toggled), l);
+
+    GtkWidget *label = gtk_label_new(l->name);
+    gtk_widget_set_halign(label, GTK_ALIGN_START);
+
+    gtk_box_pack_start(GTK_BOX(hbox), visible, FALSE, FALSE, 2);
+    gtk_box_pack_start(GTK_BOX(hbox), label, TRUE, TRUE, 2);
+
+    return hbox;
+}
+
+static
+void append_layer_rows(AppState *app, Layer *group)
+{
+    for (guint i = group->children->len; i-- > 0;) {
+        Layer *l = g_ptr_array_index(group->children, i);
+        GtkWidget *row = gtk_list_box_row_new();
+        GtkWidget *row_content = create_layer_row(app, l);
+        gtk_container_add(GTK_CONTAINER(row), row_content);
+        g_object_set_data(G_OBJECT(row), "layer_ptr", l);
+        gtk_list_box_insert(GTK_LIST_BOX(app->layer_list_box), row, -1);
+        if (l == app->active_layer)
+            gtk_list_box_select_row(GTK_LIST_BOX(app->layer_list_box), GTK_LIST_BOX_ROW(row));
+        gtk_widget_show_all(row);
+
+        if (l->kind == LAYER_KIND_GROUP && l->expanded)
+            append_layer_rows(app, l);
+    }
+}
+
+// Rebuilds the layer list from the tree, nothing to do without a window.
+void layer_panel_refresh(AppState *app)
+{
+    if (!app->layer_list_box)
+        return;
+
+    gtk_list_box_prepend(GTK_LIST_BOX(app->layer_list_box), gtk_label_new(""));
+    widgets_clear(app->layer_list_box);
+    append_layer_rows(app, app->layers->root);
+}
@@ -0,0 +1,10 @@
+#ifndef LAYER_PANEL_H
+    #define LAYER_PANEL_H
+
+#include <gtk/gtk.h>
+
+typedef struct AppState AppState;
+
+void layer_panel_refresh(AppState *app);
+
+#endif
@@ -0,0 +1,370 @@
+#include <math.h>
+
+#include "layer_stack.h"
+#include "pixel.h"
+
+LayerStack *layer_stack_new(int width, int height)
+{
+    LayerStack *stack = g_new0(LayerStack, 1);
+
+    stack->root = layer_new_group("Root");
+    stack->width = width;
+    stack->height = height;
+    return stack;
+}
+
+void layer_stack_free(LayerStack *stack)
+{
+    if (!stack) return;
+    layer_free(stack->root);
+    g_free(stack);
+}
+
+static
+void reindex_children(Layer *group, guint from)
+{
+    for (guint i = from; i < group->children->len; i++)
+        ((Layer *)g_ptr_array_index(group->children, i))->index = i;
+}
+
+void layer_stack_insert(LayerStack *stack, Layer *parent, guint index, Layer *l)
+{
+    if (!parent)
+        parent = stack->root;
+    if (index > parent->children->len)
+        index = parent->children->len;
+
+    g_ptr_array_insert(parent->children, (gint)index, l);
+    l->parent = parent;
+    reindex_children(parent, index);
+    layer_mark_dirty(l);
+}
+
+// Groups receive the new layer on top of their children, any other layer
+// gets it as its direct upper sibling.
+void layer_stack_add_above(LayerStack *stack, Layer *ref, Layer *l)
+{
+    if (!ref || !ref->parent) {
+        layer_stack_insert(stack, stack->root, stack->root->children->len, l);
+        return;
+    }
+    if (ref->kind == LAYER_KIND_GROUP)
+        layer_stack_insert(stack, ref, ref->children->len, l);
+    else
+        layer_stack_insert(stack, ref->parent, ref->index + 1, l);
+}
+
+static
+void detach(Layer *l)
+{
+    Layer *parent = l->parent;
+
+    layer_mark_dirty(l);
+    g_ptr_array_remove_index(parent->children, l->index);
+    reindex_children(parent, l->index);
+    l->parent = NULL;
+}
+
+// Moves `l` one step up (delta > 0) or down the visible order: it swaps
+// with a plain sibling, enters an adjacent group at its near end, and
+// leaves its group when already at the group's edge.
+gboolean layer_stack_move(LayerStack *stack, Layer *l, int delta)
+{
+    if (!l || !l->parent || delta == 0)
+        return FALSE;
+
+    Layer *parent = l->parent;
+    GPtrArray *siblings = parent->children;
+    gint target = (gint)l->index + (delta > 0 ? 1 : -1);
+
+    if (target < 0 || target >= (gint)siblings->len) {
+        if (parent == stack->root)
+            return FALSE;
+        detach(l);
+        layer_stack_insert(stack, parent->parent, parent->index + (delta > 0 ? 1 : 0), l);
+        return TRUE;
+    }
+
+    Layer *other = g_ptr_array_index(siblings, target);
+    if (other->kind == LAYER_KIND_GROUP) {
+        detach(l);
+        layer_stack_insert(stack, other, delta > 0 ? 0 : other->children->len, l);
+        return TRUE;
+    }
+
+    g_ptr_array_index(siblings, target) = l;
+    g_ptr_array_index(siblings, l->index) = other;
+    other->index = l->index;
+    l->index = (guint)target;
+    layer_mark_dirty(l);
+    return TRUE;
+}
+
+static
+Layer *find_in(Layer *group, guint id)
+{
+    for (guint i = 0; i < group->children->len; i++) {
+        Layer *l = g_ptr_array_index(group->children, i);
+        Layer *found = l->id == id ? l
+            : l->kind == LAYER_KIND_GROUP ? find_in(l, id) : NULL;
+        if (found)
+            return found;
+    }
+    return NULL;
+}
+
+// The layer with `id` anywhere in the tree, or NULL.
+Layer *layer_stack_find(const LayerStack *stack, guint id)
+{
+    return find_in(stack->root, id);
+}
+
+// Extends the canvas right and down so that it covers `area`.
+gboolean layer_stack_grow_canvas(LayerStack *stack, const cairo_rectangle_int_t *area)
+{
+    int w = MAX(stack->width, area->x + area->width);
+    int h = MAX(stack->height, area->y + area->height);
+
+    if (w == stack->width && h == stack->height)
+        return FALSE;
+    stack->width = w;
+    stack->height = h;
+    return TRUE;
+}
+
+static
+void content_extent(const Layer *group, cairo_rectangle_int_t *out)
+{
+    for (guint i = 0; i < group->children->len; i++) {
+        const Layer *l = g_ptr_array_index(group->children, i);
+        cairo_rectangle_int_t r = l->bounds;
+
+        if (l->kind == LAYER_KIND_GROUP)
+            content_extent(l, &r);
+        else if (l->kind != LAYER_KIND_PIXEL)
+            continue;
+        if (r.width <= 0 || r.height <= 0)
+            continue;
+        if (out->width <= 0 || out->height <= 0)
+            *out = r;
+        else
+            gdk_rectangle_union(out, &r, out);
+    }
+}
+
+// Canvas area of the composite that depends on `l`, visible or not: its
+// content, or for an adjustment whatever its group composites below it.
+void layer_stack_extent(const LayerStack *stack, const Layer *l, cairo_rectangle_int_t *out)
+{
+    *out = (cairo_rectangle_int_t){ 0, 0, 0, 0 };
+    if (l->kind == LAYER_KIND_PIXEL)
+        *out = l->bounds;
+    else if (l->kind == LAYER_KIND_GROUP)
+        content_extent(l, out);
+    else if (l->parent && l->parent != stack->root)
+        content_extent(l->parent, out);
+    else
+        *out = (cairo_rectangle_int_t){ 0, 0, stack->width, stack->height };
+}
+
+// Clips `area` to the canvas, returns FALSE if nothing is left.
+gboolean layer_stack_clip_to_canvas(const LayerStack *stack, cairo_rectangle_int_t *area)
+{
+    cairo_rectangle_int_t canvas = { 0, 0, stack->width, stack->height };
+
+    return gdk_rectangle_intersect(area, &canvas, area);
+}
+
+static
+gboolean rect_is_empty(const cairo_rectangle_int_t *r)
+{
+    return r->width <= 0 || r->height <= 0;
+}
+
+static void render_children(LayerStack *stack, Layer *group, cairo_t *cr);
+
+// The cache only spans the union of the visible children bounds and is
+// NULL when the group has no visible content. A valid cache keeps its
+// pixels and only redraws its dirty region, plus whatever the bounds
+// gained when a child grew.
+static
+cairo_surface_t *group_composite(LayerStack *stack, Layer *group)
+{
+    if (group->cache_valid && !group->cache_dirty)
+        return group->cache;
+
+    cairo_rectangle_int_t bounds = { 0, 0, 0, 0 };
+    for (guint i = 0; i < group->children->len; i++) {
+        Layer *l = g_ptr_array_index(group->children, i);
+        if (!l->visible) continue;
+        if (l->kind == LAYER_KIND_GROUP)
+            group_composite(stack, l);
+        if (rect_is_empty(&l->bounds)) continue;
+        if (rect_is_empty(&bounds))
+            bounds = l->bounds;
+        else
+            gdk_rectangle_union(&bounds, &l->bounds, &bounds);
+    }
+
+    cairo_surface_t *old = group->cache_valid ? group->cache : NULL;
+    cairo_rectangle_int_t kept = { group->x, group->y, 0, 0 };
+    cairo_region_t *redraw = cairo_region_create_rectangle(&bounds);
+
+    if (old) {
+        kept.width = cairo_image_surface_get_width(old);
+        kept.height = cairo_image_surface_get_height(old);
+        cairo_region_subtract_rectangle(redraw, &kept);
+        cairo_region_union(redraw, group->cache_dirty);
+        cairo_region_intersect_rectangle(redraw, &bounds);
+    }
+    if (group->cache_dirty) {
+        cairo_region_destroy(group->cache_dirty);
+        group->cache_dirty = NULL;
+    }
+    group->bounds = bounds;
+    group->cache_valid = TRUE;
+
+    if (rect_is_empty(&bounds)) {
+        if (group->cache)
+            cairo_surface_destroy(group->cache);
+        group->cache = NULL;
+        cairo_region_destroy(redraw);
+        return NULL;
+    }
+
+    if (group->cache && (cairo_image_surface_get_width(group->cache) != bounds.width
+            || cairo_image_surface_get_height(group->cache) != bounds.height
+            || (old && !gdk_rectangle_equal(&kept, &bounds)))) {
+        // A kept cache is still read below.
+        if (!old)
+            cairo_surface_destroy(group->cache);
+        group->cache = NULL;
+    }
+    if (!group->cache)
+        group->cache = cairo_image_surface_create(
+            CAIRO_FORMAT_ARGB32, bounds.width, bounds.height);
+    group->x = bounds.x;
+    group->y = bounds.y;
+
+    cairo_t *cr = cairo_create(group->cache);
+    cairo_translate(cr, -group->x, -group->y);
+    if (old && old != group->cache) {
+        // Moved or resized: carry over the pixels still inside the bounds.
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        cairo_set_source_surface(cr, old, kept.x, kept.y);
+        cairo_paint(cr);
+        cairo_surface_destroy(old);
+    }
+
+    // One rectangle at a time: adjustments work on the clip extents and
+    // must not run twice over pixels outside the region.
+    for (int i = 0; i < cairo_region_num_rectangles(redraw); i++) {
+        cairo_rectangle_int_t r;
+        cairo_region_get_rectangle(redraw, i, &r);
+        cairo_save(cr);
+        cairo_rectangle(cr, r.x, r.y, r.width, r.height);
+        cairo_clip(cr);
+        cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+        cairo_paint(cr);
+        cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+        render_children(stack, group, cr);
+        cairo_restore(cr);
+    }
+    cairo_destroy(cr);
+    cairo_region_destroy(redraw);
+    return group->cache;
+}
+
+// Runs the adjustment over the pixels already composited below it, limited
+// to the part of the target covered by `clip` (user coordinates).
+static
+void apply_adjustment(cairo_t *cr, const Layer *l, const cairo_rectangle_int_t *clip)
+{
+    cairo_surface_t *target = cairo_get_group_target(cr);
+    double x0 = clip->x;
+    double y0 = clip->y;
+    double x1 = clip->x + clip->width;
+    double y1 = clip->y + clip->height;
+    PixelView view;
+
+    cairo_user_to_device(cr, &x0, &y0);
+    cairo_user_to_device(cr, &x1, &y1);
+    if (!pixel_view_init(&view, target))
+        return;
+
+    int dx = (int)floor(fmin(x0, x1));
+    int dy = (int)floor(fmin(y0, y1));
+    int dw = (int)ceil(fmax(x0, x1)) - dx;
+    int dh = (int)ceil(fmax(y0, y1)) - dy;
+    PixelSpanIter it;
+    PixelSpan span;
+
+    pixel_span_iter_init(&it, &view, dx, dy, dw, dh);
+    while (pixel_span_next(&it, &span))
+        adjustment_apply(l->adjustment, span.px, (size_t)span.len, l->opacity);
+    cairo_surface_mark_dirty(target);
+}
+
+// Layers whose bounds miss the clip of `cr` are skipped entirely.
+static
+void render_children(LayerStack *stack, Layer *group, cairo_t *cr)
+{
+    double x1, y1, x2, y2;
+    cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+    cairo_rectangle_int_t clip = {
+        (int)floor(x1), (int)floor(y1),
+        (int)ceil(x2) - (int)floor(x1), (int)ceil(y2) - (int)floor(y1)
+    };
+
+    for (guint i = 0; i < group->children->len; i++) {
+        Layer *l = g_ptr_array_index(group->children, i);
+        if (!l->visible) continue;
+
+        if (l->kind == LAYER_KIND_ADJUSTMENT) {
+            apply_adjustment(cr, l, &clip);
+            continue;
+        }
+
+        cairo_surface_t *src = l->kind == LAYER_KIND_GROUP
+            ? group_composite(stack, l) : l->surface;
+        if (!src || !gdk_rectangle_intersect(&l->bounds, &clip, NULL)) continue;
+
+        cairo_save(cr);
+        cairo_rectangle(cr, l->bounds.x, l->bounds.y, l->bounds.width, l->bounds.height);
+        cairo_clip(cr);
+        if (l->locked && l->proxy) {
+            cairo_transform(cr, &l->preview);
+            cairo_set_source_surface(cr, l->proxy, 0, 0);
+            cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_BILINEAR);
+        } else {
+            cairo_set_source_surface(cr, src, l->x, l->y);
+            cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+        }
+        cairo_paint_with_alpha(cr, l->opacity);
+        cairo_restore(cr);
+    }
+}
+// Paint the visible stack into `cr` using its current transformation.
+// Groups whose children did not change since the last call are drawn from
+// their cached composite in a single paint.
+void layer_stack_render(LayerStack *stack, cairo_t *cr)
+{
+    render_children(stack, stack->root, cr);
+}
+
+// Composites the canvas area `rect` into `dst`, whose top-left pixel maps to
+// the top-left corner of `rect`. Only layers crossing `rect` are drawn.
+void layer_stack_render_rect(LayerStack *stack, cairo_surface_t *dst, const cairo_rectangle_int_t *rect)
+{
+    cairo_t *cr = cairo_create(dst);
+
+    cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+    cairo_rectangle(cr, 0, 0, rect->width, rect->height);
+    cairo_clip(cr);
+    cairo_translate(cr, -rect->x, -rect->y);
+    render_children(stack, stack->root, cr);
+    cairo_destroy(cr);
+    cairo_surface_flush(dst);
+}
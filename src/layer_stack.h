@@ -0,0 +1,31 @@
+#ifndef LAYER_STACK_H
+    #define LAYER_STACK_H
+
+#include <cairo.h>
+#include <gtk/gtk.h>
+
+#include "layer.h"
+
+// Layers are kept in contiguous arrays: the stack owns an invisible root
+// group and every group stores its children bottom to top.
+typedef struct {
+    Layer *root;
+    int width;
+    int height;
+} LayerStack;
+
+LayerStack *layer_stack_new(int width, int height);
+void layer_stack_free(LayerStack *stack);
+
+void layer_stack_insert(LayerStack *stack, Layer *parent, guint index, Layer *l);
+void layer_stack_add_above(LayerStack *stack, Layer *ref, Layer *l);
+gboolean layer_stack_move(LayerStack *stack, Layer *l, int delta);
+Layer *layer_stack_find(const LayerStack *stack, guint id);
+
+void layer_stack_extent(const LayerStack *stack, const Layer *l, cairo_rectangle_int_t *out);
+gboolean layer_stack_grow_canvas(LayerStack *stack, const cairo_rectangle_int_t *area);
+gboolean layer_stack_clip_to_canvas(const LayerStack *stack, cairo_rectangle_int_t *area);
+void layer_stack_render(LayerStack *stack, cairo_t *cr);
+void layer_stack_render_rect(LayerStack *stack, cairo_surface_t *dst, const cairo_rectangle_int_t *rect);
+
+#endif
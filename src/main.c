@@ -5,11 +5,21 @@
 #include <string.h>
 
 #include "app_state.h"
+#include "histogram_panel.h"
 #include "layer.h"
+#include "layer_panel.h"
+#include "layer_stack.h"
+#include "recorder.h"
+#include "replay.h"
 
 #define DEFAULT_CANVAS_W 512
 #define DEFAULT_CANVAS_H 512
 
+// Dirty tiles are handed to the journal writer at most this often, or
+// every JOURNAL_DRAIN_MS while a backlog larger than one flush is left.
+#define JOURNAL_INTERVAL_MS 1000
+#define JOURNAL_DRAIN_MS 50
+
 static
 void layer_fill_checkerboard(Layer *base, int cell_size)
 {
@@ -57,19 +67,10 @@ gboolean on_draw_event(GtkWidget *widget, cairo_t *cr, gpointer user_data)
     int canvas_x0 = (int)floor(app->pan_x);
     int canvas_y0 = (int)floor(app->pan_y);
 
-    for (GList *it = app->layers; it != NULL; it = it->next) {
-        Layer *l = it->data;
-        if (!l->visible || !l->surface) continue;
-
-        cairo_save(tmp_cr);
-
-        cairo_set_source_surface(tmp_cr, l->surface, -canvas_x0, -canvas_y0);
-        cairo_pattern_t *pattern = cairo_get_source(tmp_cr);
-        cairo_pattern_set_filter(pattern, CAIRO_FILTER_NEAREST);
-        cairo_paint_with_alpha(tmp_cr, l->opacity);
-
-        cairo_restore(tmp_cr);
-    }
+    cairo_translate(tmp_cr, -canvas_x0, -canvas_y0);
+    layer_stack_render(app->layers, tmp_cr);
+    if (app->current_tool && app->current_tool->draw_overlay)
+        app->current_tool->draw_overlay(app, tmp_cr);
 
     cairo_set_source_surface(cr, tmp_surface, 0, 0);
     cairo_pattern_t *pattern = cairo_get_source(cr);
@@ -77,40 +78,75 @@ gboolean on_draw_event(GtkWidget *widget, cairo_t *cr, gpointer user_data)
     cairo_paint(cr);
     cairo_destroy(tmp_cr);
     cairo_surface_destroy(tmp_surface);
+    replay_frame_done(app->replay);
     return FALSE;
 }
 
+static
+void select_tool(AppState *app, Tool *tool)
+{
+    InputEvent ev = { .kind = INPUT_TOOL, .tool = tool };
+
+    recorder_log(app->recorder, &ev);
+    input_dispatch(app, &ev);
+}
+
+static
+void log_brush_settings(AppState *app)
+{
+    InputEvent ev = {
+        .kind = INPUT_BRUSH,
+        .radius = app->brush_radius,
+        .color = app->brush_color
+    };
+
+    recorder_log(app->recorder, &ev);
+}
+
 static
 void on_brush_button(GtkButton *btn, gpointer user_data)
 {
     AppState *app = user_data;
-    app->current_tool = &TOOL_BRUSH;
+    select_tool(app, &TOOL_BRUSH);
 }
 
 static
 void on_eraser_button(GtkButton *btn, gpointer user_data)
 {
     AppState *app = user_data;
-    app->current_tool = &TOOL_ERASER;
+    select_tool(app, &TOOL_ERASER);
 }
 
 static
 void on_bucket_button(GtkButton *btn, gpointer user_data)
 {
     AppState *app = user_data;
-    app->current_tool = &TOOL_BUCKET;
+    select_tool(app, &TOOL_BUCKET);
+}
+
+static
+void on_transform_button(GtkButton *btn, gpointer user_data)
+{
+    AppState *app = user_data;
+    select_tool(app, &TOOL_TRANSFORM);
+    gtk_widget_queue_draw(app->drawing_area);
 }
 
 static void on_brush_radius_changed(GtkRange *range, gpointer user_data)
 {
     AppState *app = user_data;
     app->brush_radius = gtk_range_get_value(range);
+    log_brush_settings(app);
 }
 
 static
-void destroy_widget_cb(GtkWidget *widget, gpointer user_data)
+void on_sample_merged_toggled(GtkToggleButton *toggle, gpointer user_data)
 {
-    gtk_widget_destroy(widget);
+    AppState *app = user_data;
+    InputEvent ev = { .kind = INPUT_SAMPLE_MERGED, .enabled = gtk_toggle_button_get_active(toggle) };
+
+    recorder_log(app->recorder, &ev);
+    input_dispatch(app, &ev);
 }
 
 gboolean on_scroll(GtkWidget *widget, GdkEventScroll *event, gpointer user_data)
@@ -123,9 +159,12 @@ gboolean on_scroll(GtkWidget *widget, GdkEventScroll *event, gpointer user_data)
     double old_zoom = app->zoom;
     double mx = event->x;
     double my = event->y;
+    InputEvent ev = { .kind = INPUT_ZOOM, .zoom = app->zoom };
 
-    if (event->direction == GDK_SCROLL_UP) app->zoom *= 1.1;
-    else if (event->direction == GDK_SCROLL_DOWN) app->zoom /= 1.1;
+    if (event->direction == GDK_SCROLL_UP) ev.zoom *= 1.1;
+    else if (event->direction == GDK_SCROLL_DOWN) ev.zoom /= 1.1;
+    recorder_log(app->recorder, &ev);
+    input_dispatch(app, &ev);
 
     app->pan_x += mx / old_zoom - mx / app->zoom;
     app->pan_y += my / old_zoom - my / app->zoom;
@@ -141,54 +180,6 @@ void widget_to_canvas(AppState *app, double wx, double wy, double *cx, double *c
     *cy = wy / app->zoom + app->pan_y;
 }
 
-static
-void on_layer_visibility_toggled(GtkToggleButton *toggle, gpointer user_data)
-{
-    Layer *l = user_data;
-    l->visible = gtk_toggle_button_get_active(toggle);
-    AppState *app = g_object_get_data(G_OBJECT(toggle), "appstate");
-    gtk_widget_queue_draw(app->drawing_area);
-}
-
-static
-GtkWidget *create_layer_row(AppState *app, Layer *l)
-{
-    GtkWidget *hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
-    GtkWidget *visible = gtk_check_button_new();
-    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(visible), l->visible);
-    g_object_set_data(G_OBJECT(visible), "appstate", app);
-    g_signal_connect(visible, "toggled", G_CALLBACK(on_layer_visibility_toggled), l);
-
-    GtkWidget *label = gtk_label_new(l->name);
-    gtk_widget_set_halign(label, GTK_ALIGN_START);
-
-    gtk_box_pack_start(GTK_BOX(hbox), visible, FALSE, FALSE, 2);
-    gtk_box_pack_start(GTK_BOX(hbox), label, TRUE, TRUE, 2);
-
-    return hbox;
-}
-
-static
-void refresh_layer_list(AppState *app)
-{
-    gtk_list_box_prepend(GTK_LIST_BOX(app->layer_list_box), gtk_label_new(""));
-
-    GList *children = g_list_copy(app->layers);
-    gtk_container_foreach(GTK_CONTAINER(app->layer_list_box), (GtkCallback)destroy_widget_cb, NULL);
-    for (GList *it = g_list_last(children); it != NULL; it = it->prev) {
-        Layer *l = it->data;
-        GtkWidget *row = gtk_list_box_row_new();
-        GtkWidget *row_content = create_layer_row(app, l);
-        gtk_container_add(GTK_CONTAINER(row), row_content);
-        g_object_set_data(G_OBJECT(row), "layer_ptr", l);
-        gtk_list_box_insert(GTK_LIST_BOX(app->layer_list_box), row, -1);
-        if (l == app->active_layer)
-            gtk_list_box_select_row(GTK_LIST_BOX(app->layer_list_box), GTK_LIST_BOX_ROW(row));
-        gtk_widget_show_all(row);
-    }
-    g_list_free(children);
-}
-
 
 void on_add_layer(GtkButton *btn, gpointer user_data)
 {
@@ -211,13 +202,11 @@ void on_add_layer(GtkButton *btn, gpointer user_data)
 
     if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
         char *filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
-        Layer *l = layer_new_from_file(filename);
-        if (l) {
-            app->layers = g_list_append(app->layers, l);
-            app->active_layer = l;
-            refresh_layer_list(app);
-            gtk_widget_queue_draw(app->drawing_area);
-        }
+        InputEvent ev = { .kind = INPUT_IMPORT, .path = filename };
+
+        recorder_log(app->recorder, &ev);
+        input_dispatch(app, &ev);
+        gtk_widget_queue_draw(app->drawing_area);
         g_free(filename);
     }
     gtk_widget_destroy(dialog);
@@ -227,11 +216,36 @@ static
 void on_new_blank_layer(GtkButton *btn, gpointer user_data)
 {
     AppState *app = user_data;
-    Layer *l = layer_new_blank("Layer", DEFAULT_CANVAS_W, DEFAULT_CANVAS_H);
+    InputEvent ev = { .kind = INPUT_NEW_LAYER };
+
+    recorder_log(app->recorder, &ev);
+    input_dispatch(app, &ev);
+    gtk_widget_queue_draw(app->drawing_area);
+}
+
+static
+void on_new_group(GtkButton *btn, gpointer user_data)
+{
+    AppState *app = user_data;
+    InputEvent ev = { .kind = INPUT_NEW_GROUP };
 
-    app->layers = g_list_append(app->layers, l);
-    app->active_layer = l;
-    refresh_layer_list(app);
+    recorder_log(app->recorder, &ev);
+    input_dispatch(app, &ev);
+    gtk_widget_queue_draw(app->drawing_area);
+}
+
+static
+void on_new_adjustment(GtkButton *btn, gpointer user_data)
+{
+    AppState *app = user_data;
+    int type = gtk_combo_box_get_active(GTK_COMBO_BOX(app->adjustment_type_combo));
+    InputEvent ev = {
+        .kind = INPUT_NEW_ADJUSTMENT,
+        .adjustment_type = type < 0 ? ADJUST_LEVELS : (AdjustmentType)type
+    };
+
+    recorder_log(app->recorder, &ev);
+    input_dispatch(app, &ev);
     gtk_widget_queue_draw(app->drawing_area);
 }
 
@@ -242,8 +256,11 @@ gboolean on_button_press(GtkWidget *widget, GdkEventButton *event, gpointer user
     double cx, cy;
     widget_to_canvas(app, event->x, event->y, &cx, &cy);
 
-    if (event->button == GDK_BUTTON_PRIMARY && app->current_tool && app->current_tool->on_button_press)
-        app->current_tool->on_button_press(app, cx, cy);
+    if (event->button == GDK_BUTTON_PRIMARY) {
+        InputEvent ev = { .kind = INPUT_PRESS, .x = cx, .y = cy };
+        recorder_log(app->recorder, &ev);
+        input_dispatch(app, &ev);
+    }
 
     app->last_mouse_x = event->x;
     app->last_mouse_y = event->y;
@@ -258,8 +275,9 @@ gboolean on_motion_notify(GtkWidget *widget, GdkEventMotion *event, gpointer use
     double cx, cy;
     widget_to_canvas(app, event->x, event->y, &cx, &cy);
 
-    if (app->current_tool && app->current_tool->on_motion)
-        app->current_tool->on_motion(app, cx, cy);
+    InputEvent ev = { .kind = INPUT_MOTION, .x = cx, .y = cy };
+    recorder_log(app->recorder, &ev);
+    input_dispatch(app, &ev);
 
     gtk_widget_queue_draw(app->drawing_area);
     return TRUE;
@@ -272,8 +290,11 @@ gboolean on_button_release(GtkWidget *widget, GdkEventButton *event, gpointer us
     double cx, cy;
     widget_to_canvas(app, event->x, event->y, &cx, &cy);
 
-    if (event->button == GDK_BUTTON_PRIMARY && app->current_tool && app->current_tool->on_button_release)
-        app->current_tool->on_button_release(app, cx, cy);
+    if (event->button == GDK_BUTTON_PRIMARY) {
+        InputEvent ev = { .kind = INPUT_RELEASE, .x = cx, .y = cy };
+        recorder_log(app->recorder, &ev);
+        input_dispatch(app, &ev);
+    }
 
     gtk_widget_queue_draw(app->drawing_area);
     return TRUE;
@@ -296,47 +317,35 @@ void on_layer_row_selected(GtkListBox *box, GtkListBoxRow *row, gpointer user_da
     AppState *app = user_data;
     if (!row) return;
 
+    // Rebuilding the list selects the active row again, which is no input.
     Layer *l = g_object_get_data(G_OBJECT(row), "layer_ptr");
-    if (l) {
-        app->active_layer = l;
+    if (l && l != app->active_layer) {
+        InputEvent ev = { .kind = INPUT_SELECT_LAYER, .layer_id = l->id };
+
+        recorder_log(app->recorder, &ev);
+        input_dispatch(app, &ev);
         gtk_widget_queue_draw(app->drawing_area);
     }
 }
 
-void on_move_layer_up(GtkButton *btn, gpointer user_data)
+static
+void move_active_layer(AppState *app, int delta)
 {
-    AppState *app = user_data;
-    if (!app->active_layer || !app->layers)
-        return;
+    InputEvent ev = { .kind = INPUT_MOVE_LAYER, .delta = delta };
 
-    GList *node = g_list_find(app->layers, app->active_layer);
-    if (!node || !node->next)
-        return;
-
-    gpointer next_data = node->next->data;
-    node->next->data = node->data;
-    node->data = next_data;
-
-    refresh_layer_list(app);
+    recorder_log(app->recorder, &ev);
+    input_dispatch(app, &ev);
     gtk_widget_queue_draw(app->drawing_area);
 }
 
-void on_move_layer_down(GtkButton *btn, gpointer user_data)
+void on_move_layer_up(GtkButton *btn, gpointer user_data)
 {
-    AppState *app = user_data;
-    if (!app->active_layer || !app->layers)
-        return;
-
-    GList *node = g_list_find(app->layers, app->active_layer);
-    if (!node || !node->prev)
-        return;
-
-    gpointer prev_data = node->prev->data;
-    node->prev->data = node->data;
-    node->data = prev_data;
+    move_active_layer(user_data, 1);
+}
 
-    refresh_layer_list(app);
-    gtk_widget_queue_draw(app->drawing_area);
+void on_move_layer_down(GtkButton *btn, gpointer user_data)
+{
+    move_active_layer(user_data, -1);
 }
 
 static
@@ -344,6 +353,7 @@ void on_brush_color_changed(GtkColorButton *button, gpointer user_data)
 {
     AppState *app = user_data;
     gtk_color_chooser_get_rgba(GTK_COLOR_CHOOSER(button), &app->brush_color);
+    log_brush_settings(app);
 }
 
 void build_ui(AppState *app)
@@ -371,6 +381,16 @@ void build_ui(AppState *app)
     g_signal_connect(bucket_btn, "clicked", G_CALLBACK(on_bucket_button), app);
     gtk_box_pack_start(GTK_BOX(tools_vbox), bucket_btn, FALSE, FALSE, 2);
 
+    GtkWidget *transform_btn = gtk_button_new_with_label("Transform");
+    g_signal_connect(transform_btn, "clicked", G_CALLBACK(on_transform_button), app);
+    gtk_box_pack_start(GTK_BOX(tools_vbox), transform_btn, FALSE, FALSE, 2);
+
+    GtkWidget *merged_check = gtk_check_button_new_with_label("Sample Merged");
+    gtk_widget_set_tooltip_text(merged_check, "Bucket fill finds regions in all visible layers");
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(merged_check), app->sample_merged);
+    g_signal_connect(merged_check, "toggled", G_CALLBACK(on_sample_merged_toggled), app);
+    gtk_box_pack_start(GTK_BOX(tools_vbox), merged_check, FALSE, FALSE, 2);
+
     GtkWidget *radius_label = gtk_label_new("Brush Radius");
     gtk_box_pack_start(GTK_BOX(tools_vbox), radius_label, FALSE, FALSE, 2);
     GtkWidget *radius_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 1, 50, 1);
@@ -422,6 +442,21 @@ void build_ui(AppState *app)
     g_signal_connect(new_btn, "clicked", G_CALLBACK(on_new_blank_layer), app);
     gtk_box_pack_start(GTK_BOX(layers_vbox), new_btn, FALSE, FALSE, 2);
 
+    GtkWidget *group_btn = gtk_button_new_with_label("New Group");
+    g_signal_connect(group_btn, "clicked", G_CALLBACK(on_new_group), app);
+    gtk_box_pack_start(GTK_BOX(layers_vbox), group_btn, FALSE, FALSE, 2);
+
+    app->adjustment_type_combo = gtk_combo_box_text_new();
+    for (size_t i = 0; i < G_N_ELEMENTS(ADJUSTMENT_NAMES); i++)
+        gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(app->adjustment_type_combo),
+            ADJUSTMENT_NAMES[i]);
+    gtk_combo_box_set_active(GTK_COMBO_BOX(app->adjustment_type_combo), 0);
+    gtk_box_pack_start(GTK_BOX(layers_vbox), app->adjustment_type_combo, FALSE, FALSE, 2);
+
+    GtkWidget *adjustment_btn = gtk_button_new_with_label("New Adjustment");
+    g_signal_connect(adjustment_btn, "clicked", G_CALLBACK(on_new_adjustment), app);
+    gtk_box_pack_start(GTK_BOX(layers_vbox), adjustment_btn, FALSE, FALSE, 2);
+
     GtkWidget *move_up_btn = gtk_button_new_with_label("Move Up");
     g_signal_connect(move_up_btn, "clicked", G_CALLBACK(on_move_layer_up), app);
     gtk_box_pack_start(GTK_BOX(layers_vbox), move_up_btn, FALSE, FALSE, 2);
@@ -438,12 +473,142 @@ void build_ui(AppState *app)
     g_signal_connect(app->layer_list_box, "row-selected",
                      G_CALLBACK(on_layer_row_selected), app);
     gtk_box_pack_start(GTK_BOX(layers_vbox), app->layer_list_box, TRUE, TRUE, 2);
+
+    app->adjustment_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 2);
+    gtk_box_pack_start(GTK_BOX(layers_vbox), app->adjustment_box, FALSE, FALSE, 2);
+
+    gtk_box_pack_start(GTK_BOX(layers_vbox), histogram_panel_new(app), FALSE, FALSE, 2);
 }
 
 
+static char *record_file = NULL;
+static char *replay_file = NULL;
+static gboolean replay_max_speed = FALSE;
+static gboolean replay_headless = FALSE;
+
+static GOptionEntry OPTIONS[] = {
+    { "record", 0, 0, G_OPTION_ARG_FILENAME, &record_file,
+        "Record input events, tool, brush and layer panel changes to FILE", "FILE" },
+    { "replay", 0, 0, G_OPTION_ARG_FILENAME, &replay_file,
+        "Replay the events of FILE, report timings and quit", "FILE" },
+    { "max-speed", 0, 0, G_OPTION_ARG_NONE, &replay_max_speed,
+        "Replay as fast as possible instead of at the recorded pace", NULL },
+    { "headless", 0, 0, G_OPTION_ARG_NONE, &replay_headless,
+        "Replay without opening a window", NULL },
+    { NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+static
+gboolean parse_options(int *argc, char ***argv, GError **err)
+{
+    GOptionContext *ctx = g_option_context_new(NULL);
+    gboolean ok;
+
+    g_option_context_add_main_entries(ctx, OPTIONS, NULL);
+    // Leave GTK's own options for gtk_init().
+    g_option_context_set_ignore_unknown_options(ctx, TRUE);
+    ok = g_option_context_parse(ctx, argc, argv, err);
+    g_option_context_free(ctx);
+    if (ok && replay_headless && !replay_file) {
+        g_set_error(err, G_OPTION_ERROR, G_OPTION_ERROR_FAILED,
+            "--headless requires --replay");
+        return FALSE;
+    }
+    return ok;
+}
+
+static
+void new_document(AppState *app)
+{
+    app->layers = layer_stack_new(DEFAULT_CANVAS_W, DEFAULT_CANVAS_H);
+    Layer *base = layer_new_blank("Base", DEFAULT_CANVAS_W, DEFAULT_CANVAS_H);
+    layer_fill_checkerboard(base, 10);
+    layer_stack_add_above(app->layers, NULL, base);
+    app->active_layer = base;
+}
+
+static guint journal_drain_source = 0;
+
+static
+gboolean on_journal_drain(gpointer user_data)
+{
+    AppState *app = user_data;
+
+    if (journal_flush(app->journal, app->layers))
+        return G_SOURCE_CONTINUE;
+    journal_drain_source = 0;
+    return G_SOURCE_REMOVE;
+}
+
+static
+gboolean on_journal_timer(gpointer user_data)
+{
+    AppState *app = user_data;
+
+    if (journal_flush(app->journal, app->layers) && !journal_drain_source)
+        journal_drain_source = g_timeout_add(JOURNAL_DRAIN_MS, on_journal_drain, app);
+    return G_SOURCE_CONTINUE;
+}
+
+static
+gboolean ask_restore(AppState *app)
+{
+    GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(app->window),
+        GTK_DIALOG_MODAL, GTK_MESSAGE_QUESTION, GTK_BUTTONS_YES_NO,
+        "Restore the work of the previous session?");
+    gboolean restore = gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_YES;
+
+    gtk_widget_destroy(dialog);
+    return restore;
+}
+
+// Offers to recover the previous session, then starts a fresh journal
+// beginning with a full snapshot of the document. Returns TRUE if the
+// document was restored.
+static
+gboolean start_journal(AppState *app)
+{
+    GError *err = NULL;
+    char *path = journal_default_path();
+    gboolean recovered = FALSE;
+
+    if (g_file_test(path, G_FILE_TEST_EXISTS) && ask_restore(app)) {
+        LayerStack *restored = journal_restore(path, &err);
+        if (restored && restored->root->children->len > 0) {
+            layer_stack_free(app->layers);
+            app->layers = restored;
+            app->active_layer = g_ptr_array_index(restored->root->children,
+                restored->root->children->len - 1);
+            recovered = TRUE;
+        } else {
+            if (err)
+                g_warning("Recovery failed: %s", err->message);
+            g_clear_error(&err);
+            layer_stack_free(restored);
+        }
+    }
+
+    app->journal = journal_open(path, app->layers, &err);
+    if (!app->journal) {
+        g_warning("Autosave disabled: %s", err->message);
+        g_error_free(err);
+    }
+    journal_note_stack(app->journal, app->layers->root);
+    on_journal_timer(app);
+    g_timeout_add(JOURNAL_INTERVAL_MS, on_journal_timer, app);
+    g_free(path);
+    return recovered;
+}
+
 int main(int argc, char *argv[])
 {
-    gtk_init(&argc, &argv);
+    GError *err = NULL;
+
+    if (!parse_options(&argc, &argv, &err)) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return 1;
+    }
 
     AppState *app = g_new0(AppState, 1);
 
@@ -454,24 +619,59 @@ int main(int argc, char *argv[])
     app->brush_radius = 10.0;
     gdk_rgba_parse(&app->brush_color, "#000000");
 
+    if (replay_file) {
+        GArray *events = recording_load(replay_file, &err);
+        if (!events) {
+            g_printerr("%s\n", err->message);
+            g_error_free(err);
+            g_free(app);
+            return 1;
+        }
+        app->replay = replay_new(events, replay_max_speed);
+    }
+
+    if (replay_headless) {
+        new_document(app);
+        replay_run_headless(app->replay, app);
+        replay_report(app->replay);
+        replay_free(app->replay);
+        layer_stack_free(app->layers);
+        g_free(app);
+        return 0;
+    }
+
+    gtk_init(&argc, &argv);
+
     GtkSettings *settings = gtk_settings_get_default();
     g_object_set(settings, "gtk-application-prefer-dark-theme", is_dark, NULL);
 
     build_ui(app);
 
-    Layer *base = layer_new_blank("Base", DEFAULT_CANVAS_W, DEFAULT_CANVAS_H);
-    layer_fill_checkerboard(base, 10);
-    app->layers = g_list_append(app->layers, base);
-    app->active_layer = base;
-    refresh_layer_list(app);
+    new_document(app);
+    // Replays must neither prompt nor overwrite the real recovery journal.
+    gboolean restored = !app->replay && start_journal(app);
+    app->histograms = histogram_cache_new();
+    layer_panel_refresh(app);
+
+    // Recording starts from the document just set up.
+    if (record_file) {
+        app->recorder = recorder_open(record_file, app, restored, &err);
+        if (!app->recorder) {
+            g_warning("Input recording disabled: %s", err->message);
+            g_clear_error(&err);
+        }
+    }
 
     gtk_widget_show_all(app->window);
-    gtk_main();
-
-    for (GList *it = app->layers; it != NULL; it = it->next) {
-        layer_free(it->data);
-    }
-    g_list_free(app->layers);
+    if (!app->replay || replay_start(app->replay, app))
+        gtk_main();
+
+    journal_flush(app->journal, app->layers);
+    journal_close(app->journal);
+    recorder_close(app->recorder);
+    replay_free(app->replay);
+    histogram_cache_free(app->histograms);
+    layer_stack_free(app->layers);
     g_object_unref(app->css_provider);
     g_free(app);
     return 0;
@@ -0,0 +1,158 @@
+#include <math.h>
+#include <stdlib.h>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+#include "pixel.h"
+
+// unpremul_lut[a][c] = c * 255 / a, rounded and saturated.
+static guint8 unpremul_lut[256][256];
+
+static
+void init_unpremul_lut(void)
+{
+    static gsize initialized = 0;
+
+    if (!g_once_init_enter(&initialized))
+        return;
+    for (int a = 1; a < 256; a++)
+        for (int c = 0; c < 256; c++)
+            unpremul_lut[a][c] = (guint8)MIN(255, (c * 255 + a / 2) / a);
+    g_once_init_leave(&initialized, 1);
+}
+
+// Exact rounded c * a / 255 without a division.
+static inline
+uint32_t mul_div255(uint32_t c, uint32_t a)
+{
+    uint32_t t = c * a + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+// Flushes pending cairo drawing; callers mark the surface dirty once done.
+gboolean pixel_view_init(PixelView *view, cairo_surface_t *surface)
+{
+    if (!surface || cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+        return FALSE;
+
+    cairo_surface_flush(surface);
+    view->data = cairo_image_surface_get_data(surface);
+    view->stride = cairo_image_surface_get_stride(surface);
+    view->width = cairo_image_surface_get_width(surface);
+    view->height = cairo_image_surface_get_height(surface);
+    return view->data != NULL;
+}
+
+void pixel_span_iter_init(PixelSpanIter *it, const PixelView *view, int x, int y, int w, int h)
+{
+    int x1 = MIN(x + w, view->width);
+
+    it->view = view;
+    it->x = MAX(x, 0);
+    it->y = MAX(y, 0);
+    it->end_y = MIN(y + h, view->height);
+    it->width = MAX(x1 - it->x, 0);
+}
+
+gboolean pixel_span_next(PixelSpanIter *it, PixelSpan *span)
+{
+    if (it->width == 0 || it->y >= it->end_y)
+        return FALSE;
+
+    span->px = pixel_row(it->view, it->y) + it->x;
+    span->x = it->x;
+    span->y = it->y;
+    span->len = it->width;
+    it->y++;
+    return TRUE;
+}
+
+uint32_t pixel_from_rgba(const GdkRGBA *c)
+{
+    uint32_t a = (uint32_t)lround(CLAMP(c->alpha, 0.0, 1.0) * 255);
+
+    return PIXEL_PACK(a,
+        mul_div255((uint32_t)lround(CLAMP(c->red, 0.0, 1.0) * 255), a),
+        mul_div255((uint32_t)lround(CLAMP(c->green, 0.0, 1.0) * 255), a),
+        mul_div255((uint32_t)lround(CLAMP(c->blue, 0.0, 1.0) * 255), a));
+}
+
+// Per-channel comparison of two packed pixels, exact matches short-circuit.
+gboolean pixel_within(uint32_t a, uint32_t b, int tolerance)
+{
+    if (a == b)
+        return TRUE;
+    if (tolerance <= 0)
+        return FALSE;
+    for (int shift = 0; shift < 32; shift += 8) {
+        int d = (int)((a >> shift) & 0xff) - (int)((b >> shift) & 0xff);
+        if (abs(d) > tolerance)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static inline
+uint32_t premultiply_one(uint32_t p)
+{
+    uint32_t a = PIXEL_A(p);
+
+    if (a == 255) return p;
+    return PIXEL_PACK(a,
+        mul_div255(PIXEL_R(p), a),
+        mul_div255(PIXEL_G(p), a),
+        mul_div255(PIXEL_B(p), a));
+}
+
+#ifdef __SSE2__
+// Premultiplies two pixels widened to 16-bit lanes, alpha lanes untouched.
+static inline
+__m128i premultiply_lanes(__m128i px)
+{
+    const __m128i alpha_mask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    __m128i alpha = _mm_shufflehi_epi16(
+        _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(px, alpha), _mm_set1_epi16(128));
+
+    t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    return _mm_or_si128(_mm_andnot_si128(alpha_mask, t), _mm_and_si128(alpha_mask, px));
+}
+#endif
+
+// Converts `n` straight-alpha pixels to premultiplied, `dst` may be `src`.
+void pixel_premultiply(uint32_t *dst, const uint32_t *src, size_t n)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i px = _mm_loadu_si128((const __m128i *)(const void *)(src + i));
+        __m128i lo = premultiply_lanes(_mm_unpacklo_epi8(px, zero));
+        __m128i hi = premultiply_lanes(_mm_unpackhi_epi8(px, zero));
+        _mm_storeu_si128((__m128i *)(void *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = premultiply_one(src[i]);
+}
+
+// Converts `n` premultiplied pixels to straight alpha, `dst` may be `src`.
+void pixel_unpremultiply(uint32_t *dst, const uint32_t *src, size_t n)
+{
+    init_unpremul_lut();
+    for (size_t i = 0; i < n; i++) {
+        uint32_t p = src[i];
+        uint32_t a = PIXEL_A(p);
+
+        if (a == 255 || a == 0) {
+            dst[i] = a ? p : 0;
+            continue;
+        }
+        const guint8 *lut = unpremul_lut[a];
+        dst[i] = PIXEL_PACK(a, lut[PIXEL_R(p)], lut[PIXEL_G(p)], lut[PIXEL_B(p)]);
+    }
+}
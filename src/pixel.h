@@ -0,0 +1,54 @@
+#ifndef PIXEL_H
+    #define PIXEL_H
+
+#include <cairo.h>
+#include <gtk/gtk.h>
+#include <stdint.h>
+
+// Pixels are handled the way cairo stores CAIRO_FORMAT_ARGB32: one native
+// endian 32-bit word per pixel, alpha in the top byte, color premultiplied.
+#define PIXEL_A(p) (((p) >> 24) & 0xff)
+#define PIXEL_R(p) (((p) >> 16) & 0xff)
+#define PIXEL_G(p) (((p) >> 8) & 0xff)
+#define PIXEL_B(p) ((p) & 0xff)
+#define PIXEL_PACK(a, r, g, b) \
+    (((uint32_t)(a) << 24) | ((uint32_t)(r) << 16) | ((uint32_t)(g) << 8) | (uint32_t)(b))
+
+// Surface data and geometry, fetched once instead of on every access.
+typedef struct {
+    unsigned char *data;
+    int stride;
+    int width;
+    int height;
+} PixelView;
+
+// Walks the rows of a rectangle clipped to the view, one span per row.
+typedef struct {
+    const PixelView *view;
+    int x, y, end_y;
+    int width;
+} PixelSpanIter;
+
+typedef struct {
+    uint32_t *px;
+    int x, y;
+    int len;
+} PixelSpan;
+
+gboolean pixel_view_init(PixelView *view, cairo_surface_t *surface);
+
+static inline uint32_t *pixel_row(const PixelView *view, int y)
+{
+    return (uint32_t *)(void *)(view->data + (size_t)y * view->stride);
+}
+
+void pixel_span_iter_init(PixelSpanIter *it, const PixelView *view, int x, int y, int w, int h);
+gboolean pixel_span_next(PixelSpanIter *it, PixelSpan *span);
+
+uint32_t pixel_from_rgba(const GdkRGBA *c);
+gboolean pixel_within(uint32_t a, uint32_t b, int tolerance);
+
+void pixel_premultiply(uint32_t *dst, const uint32_t *src, size_t n);
+void pixel_unpremultiply(uint32_t *dst, const uint32_t *src, size_t n);
+
+#endif
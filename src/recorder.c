@@ -0,0 +1,420 @@
+#include <errno.h>
+#include <string.h>
+
+#include "app_state.h"
+#include "recorder.h"
+
+#define RECORDING_HEADER "# epi-gimp input recording v1"
+
+static const char *const KIND_NAMES[] = {
+    [INPUT_PRESS] = "press",
+    [INPUT_MOTION] = "motion",
+    [INPUT_RELEASE] = "release",
+    [INPUT_TOOL] = "tool",
+    [INPUT_BRUSH] = "brush",
+    [INPUT_SAMPLE_MERGED] = "sample-merged",
+    [INPUT_ZOOM] = "zoom",
+    [INPUT_DOCUMENT] = "document",
+    [INPUT_NEW_LAYER] = "new-layer",
+    [INPUT_NEW_GROUP] = "new-group",
+    [INPUT_NEW_ADJUSTMENT] = "new-adjustment",
+    [INPUT_IMPORT] = "import",
+    [INPUT_SELECT_LAYER] = "select",
+    [INPUT_VISIBILITY] = "visible",
+    [INPUT_MOVE_LAYER] = "move",
+    [INPUT_ADJUSTMENT] = "adjustment",
+};
+
+// Adjustment events carry the type, every setting and the opacity.
+#define ADJUSTMENT_VALUES (8 + 2 * CURVE_MAX_POINTS + 5)
+
+// Live GTK handlers and replays both go through here, so a replayed session
+// exercises exactly the same code as the one that was recorded.
+void input_dispatch(AppState *app, const InputEvent *ev)
+{
+    Tool *tool = app->current_tool;
+
+    switch (ev->kind) {
+    case INPUT_PRESS:
+        if (tool && tool->on_button_press)
+            tool->on_button_press(app, ev->x, ev->y);
+        break;
+    case INPUT_MOTION:
+        if (tool && tool->on_motion)
+            tool->on_motion(app, ev->x, ev->y);
+        break;
+    case INPUT_RELEASE:
+        if (tool && tool->on_button_release)
+            tool->on_button_release(app, ev->x, ev->y);
+        break;
+    case INPUT_TOOL:
+        if (ev->tool)
+            app->current_tool = ev->tool;
+        break;
+    case INPUT_BRUSH:
+        app->brush_radius = ev->radius;
+        app->brush_color = ev->color;
+        break;
+    case INPUT_SAMPLE_MERGED:
+        app->sample_merged = ev->enabled;
+        break;
+    case INPUT_ZOOM:
+        app->zoom = ev->zoom;
+        break;
+    case INPUT_DOCUMENT:
+        break;
+    case INPUT_NEW_LAYER:
+        app_add_layer(app, layer_new_empty("Layer"));
+        break;
+    case INPUT_NEW_GROUP:
+        app_add_layer(app, layer_new_group("Group"));
+        break;
+    case INPUT_NEW_ADJUSTMENT:
+        app_add_layer(app, layer_new_adjustment(ev->adjustment_type));
+        break;
+    case INPUT_IMPORT:
+        app_import_layer(app, ev->path);
+        break;
+    case INPUT_SELECT_LAYER:
+        app_select_layer(app, layer_stack_find(app->layers, ev->layer_id));
+        break;
+    case INPUT_VISIBILITY:
+        app_set_layer_visible(app, layer_stack_find(app->layers, ev->layer_id), ev->enabled);
+        break;
+    case INPUT_MOVE_LAYER:
+        app_move_layer(app, ev->delta);
+        break;
+    case INPUT_ADJUSTMENT:
+        app_set_adjustment(app, &ev->params, ev->opacity);
+        break;
+    }
+}
+
+// `restored` tells that the document came from the recovery journal, which
+// replays cannot rebuild.
+Recorder *recorder_open(const char *filename, AppState *app, gboolean restored, GError **err)
+{
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        g_set_error(err, G_FILE_ERROR, g_file_error_from_errno(errno),
+            "Cannot open '%s': %s", filename, g_strerror(errno));
+        return NULL;
+    }
+
+    Recorder *rec = g_new0(Recorder, 1);
+    rec->file = file;
+    rec->start = g_get_monotonic_time();
+    fputs(RECORDING_HEADER "\n", file);
+
+    recorder_log(rec, &(InputEvent){ .kind = INPUT_DOCUMENT, .enabled = restored });
+    // Start from the current tool settings so the replay begins identically.
+    recorder_log(rec, &(InputEvent){ .kind = INPUT_TOOL, .tool = app->current_tool });
+    recorder_log(rec, &(InputEvent){
+        .kind = INPUT_BRUSH,
+        .radius = app->brush_radius,
+        .color = app->brush_color
+    });
+    recorder_log(rec, &(InputEvent){ .kind = INPUT_SAMPLE_MERGED, .enabled = app->sample_merged });
+    recorder_log(rec, &(InputEvent){ .kind = INPUT_ZOOM, .zoom = app->zoom });
+    return rec;
+}
+
+static
+void write_double(FILE *file, double v)
+{
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    fputc(' ', file);
+    fputs(g_ascii_formatd(buf, sizeof buf, "%.3f", v), file);
+}
+
+// For values that must read back bit for bit.
+static
+void write_exact(FILE *file, double v)
+{
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    fputc(' ', file);
+    fputs(g_ascii_dtostr(buf, sizeof buf, v), file);
+}
+
+// Adjustment settings in the order they are written.
+static
+void adjustment_to_values(const AdjustmentParams *p, double opacity, double *v)
+{
+    int n = 0;
+
+    v[n++] = p->type;
+    v[n++] = p->in_black;
+    v[n++] = p->in_white;
+    v[n++] = p->gamma;
+    v[n++] = p->out_black;
+    v[n++] = p->out_white;
+    v[n++] = p->n_points;
+    for (int i = 0; i < CURVE_MAX_POINTS; i++) {
+        v[n++] = p->points[i][0];
+        v[n++] = p->points[i][1];
+    }
+    v[n++] = p->hue;
+    v[n++] = p->saturation;
+    v[n++] = p->lightness;
+    v[n++] = p->brightness;
+    v[n++] = p->contrast;
+    v[n++] = opacity;
+}
+
+static
+gboolean adjustment_from_values(const double *v, AdjustmentParams *p, double *opacity)
+{
+    int n = 0;
+
+    if (v[0] < 0 || v[0] >= ADJUST_TYPE_COUNT || v[6] < 0 || v[6] > CURVE_MAX_POINTS)
+        return FALSE;
+    p->type = (AdjustmentType)v[n++];
+    p->in_black = v[n++];
+    p->in_white = v[n++];
+    p->gamma = v[n++];
+    p->out_black = v[n++];
+    p->out_white = v[n++];
+    p->n_points = (guint)v[n++];
+    for (int i = 0; i < CURVE_MAX_POINTS; i++) {
+        p->points[i][0] = v[n++];
+        p->points[i][1] = v[n++];
+    }
+    p->hue = v[n++];
+    p->saturation = v[n++];
+    p->lightness = v[n++];
+    p->brightness = v[n++];
+    p->contrast = v[n++];
+    *opacity = v[n++];
+    return TRUE;
+}
+
+// Written exactly: a replay must compile the same lookup tables.
+static
+void write_adjustment(FILE *file, const AdjustmentParams *p, double opacity)
+{
+    double v[ADJUSTMENT_VALUES];
+
+    adjustment_to_values(p, opacity, v);
+    for (int i = 0; i < ADJUSTMENT_VALUES; i++)
+        write_exact(file, v[i]);
+}
+
+// Stamps `ev` with the time elapsed since the recording started and appends
+// it to the file. Numbers are written in the C locale whatever GTK set.
+void recorder_log(Recorder *rec, InputEvent *ev)
+{
+    if (!rec) return;
+
+    ev->time = g_get_monotonic_time() - rec->start;
+    fprintf(rec->file, "%" G_GINT64_FORMAT " %s", ev->time, KIND_NAMES[ev->kind]);
+
+    switch (ev->kind) {
+    case INPUT_PRESS:
+    case INPUT_MOTION:
+    case INPUT_RELEASE:
+        write_double(rec->file, ev->x);
+        write_double(rec->file, ev->y);
+        break;
+    case INPUT_TOOL:
+        fprintf(rec->file, " %s", ev->tool ? ev->tool->name : "");
+        break;
+    case INPUT_BRUSH:
+        write_double(rec->file, ev->radius);
+        write_double(rec->file, ev->color.red);
+        write_double(rec->file, ev->color.green);
+        write_double(rec->file, ev->color.blue);
+        write_double(rec->file, ev->color.alpha);
+        break;
+    case INPUT_SAMPLE_MERGED:
+        fprintf(rec->file, " %d", ev->enabled ? 1 : 0);
+        break;
+    case INPUT_ZOOM:
+        write_exact(rec->file, ev->zoom);
+        break;
+    case INPUT_DOCUMENT:
+        fputs(ev->enabled ? " restored" : " new", rec->file);
+        break;
+    case INPUT_NEW_LAYER:
+    case INPUT_NEW_GROUP:
+        break;
+    case INPUT_NEW_ADJUSTMENT:
+        fprintf(rec->file, " %d", (int)ev->adjustment_type);
+        break;
+    case INPUT_IMPORT:
+        fprintf(rec->file, " %s", ev->path);
+        break;
+    case INPUT_SELECT_LAYER:
+        fprintf(rec->file, " %u", ev->layer_id);
+        break;
+    case INPUT_VISIBILITY:
+        fprintf(rec->file, " %u %d", ev->layer_id, ev->enabled ? 1 : 0);
+        break;
+    case INPUT_MOVE_LAYER:
+        fprintf(rec->file, " %d", ev->delta);
+        break;
+    case INPUT_ADJUSTMENT:
+        write_adjustment(rec->file, &ev->params, ev->opacity);
+        break;
+    }
+    fputc('\n', rec->file);
+}
+
+void recorder_close(Recorder *rec)
+{
+    if (!rec) return;
+    fclose(rec->file);
+    g_free(rec);
+}
+
+static
+gboolean parse_kind(char **cursor, InputKind *kind)
+{
+    char *p = *cursor;
+
+    while (*p == ' ') p++;
+    for (size_t i = 0; i < G_N_ELEMENTS(KIND_NAMES); i++) {
+        size_t len = strlen(KIND_NAMES[i]);
+        if (strncmp(p, KIND_NAMES[i], len) == 0 && (p[len] == ' ' || p[len] == '\0')) {
+            *kind = (InputKind)i;
+            *cursor = p + len;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static
+gboolean parse_doubles(const char *p, double *out, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        char *end;
+        out[i] = g_ascii_strtod(p, &end);
+        if (end == p) return FALSE;
+        p = end;
+    }
+    return TRUE;
+}
+
+static
+gboolean parse_line(char *line, InputEvent *ev)
+{
+    char *end;
+    double v[ADJUSTMENT_VALUES];
+
+    ev->time = g_ascii_strtoll(line, &end, 10);
+    if (end == line || !parse_kind(&end, &ev->kind))
+        return FALSE;
+
+    switch (ev->kind) {
+    case INPUT_PRESS:
+    case INPUT_MOTION:
+    case INPUT_RELEASE:
+        if (!parse_doubles(end, v, 2)) return FALSE;
+        ev->x = v[0];
+        ev->y = v[1];
+        return TRUE;
+    case INPUT_TOOL:
+        ev->tool = tool_find(g_strstrip(end));
+        return ev->tool != NULL;
+    case INPUT_BRUSH:
+        if (!parse_doubles(end, v, 5)) return FALSE;
+        ev->radius = v[0];
+        ev->color = (GdkRGBA){ v[1], v[2], v[3], v[4] };
+        return TRUE;
+    case INPUT_SAMPLE_MERGED:
+        if (!parse_doubles(end, v, 1)) return FALSE;
+        ev->enabled = v[0] != 0.0;
+        return TRUE;
+    case INPUT_ZOOM:
+        if (!parse_doubles(end, v, 1) || v[0] <= 0.0) return FALSE;
+        ev->zoom = v[0];
+        return TRUE;
+    case INPUT_DOCUMENT:
+        end = g_strstrip(end);
+        ev->enabled = strcmp(end, "restored") == 0;
+        return ev->enabled || strcmp(end, "new") == 0;
+    case INPUT_NEW_LAYER:
+    case INPUT_NEW_GROUP:
+        return TRUE;
+    case INPUT_NEW_ADJUSTMENT:
+        if (!parse_doubles(end, v, 1) || v[0] < 0 || v[0] >= ADJUST_TYPE_COUNT) return FALSE;
+        ev->adjustment_type = (AdjustmentType)v[0];
+        return TRUE;
+    case INPUT_IMPORT:
+        end = g_strstrip(end);
+        if (*end == '\0') return FALSE;
+        ev->path = g_strdup(end);
+        return TRUE;
+    case INPUT_SELECT_LAYER:
+        if (!parse_doubles(end, v, 1)) return FALSE;
+        ev->layer_id = (guint)v[0];
+        return TRUE;
+    case INPUT_VISIBILITY:
+        if (!parse_doubles(end, v, 2)) return FALSE;
+        ev->layer_id = (guint)v[0];
+        ev->enabled = v[1] != 0.0;
+        return TRUE;
+    case INPUT_MOVE_LAYER:
+        if (!parse_doubles(end, v, 1)) return FALSE;
+        ev->delta = (int)v[0];
+        return TRUE;
+    case INPUT_ADJUSTMENT:
+        return parse_doubles(end, v, ADJUSTMENT_VALUES)
+            && adjustment_from_values(v, &ev->params, &ev->opacity);
+    }
+    return FALSE;
+}
+
+static
+void input_event_clear(gpointer data)
+{
+    InputEvent *ev = data;
+
+    g_free(ev->path);
+}
+
+// Returns a GArray of InputEvent, or NULL with `err` set. Recordings of a
+// session restored from the journal are refused, as their layers are not
+// there to replay onto.
+GArray *recording_load(const char *filename, GError **err)
+{
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        g_set_error(err, G_FILE_ERROR, g_file_error_from_errno(errno),
+            "Cannot open '%s': %s", filename, g_strerror(errno));
+        return NULL;
+    }
+
+    GArray *events = g_array_new(FALSE, TRUE, sizeof(InputEvent));
+    char line[4096];
+
+    g_array_set_clear_func(events, input_event_clear);
+    int lineno = 0;
+
+    while (fgets(line, sizeof line, file)) {
+        InputEvent ev = { 0 };
+
+        lineno++;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (!parse_line(line, &ev)) {
+            g_set_error(err, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                "%s:%d: malformed event", filename, lineno);
+            g_array_free(events, TRUE);
+            fclose(file);
+            return NULL;
+        }
+        if (ev.kind == INPUT_DOCUMENT && ev.enabled) {
+            g_set_error(err, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                "%s: recorded on a document restored from the journal, cannot replay", filename);
+            g_array_free(events, TRUE);
+            fclose(file);
+            return NULL;
+        }
+        g_array_append_val(events, ev);
+    }
+    fclose(file);
+    return events;
+}
@@ -0,0 +1,66 @@
+#ifndef RECORDER_H
+    #define RECORDER_H
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+
+#include "adjustment.h"
+#include "tools.h"
+
+typedef struct AppState AppState;
+
+typedef enum {
+    INPUT_PRESS,
+    INPUT_MOTION,
+    INPUT_RELEASE,
+    INPUT_TOOL,
+    INPUT_BRUSH,
+    INPUT_SAMPLE_MERGED,
+    INPUT_ZOOM,
+    INPUT_DOCUMENT,
+    INPUT_NEW_LAYER,
+    INPUT_NEW_GROUP,
+    INPUT_NEW_ADJUSTMENT,
+    INPUT_IMPORT,
+    INPUT_SELECT_LAYER,
+    INPUT_VISIBILITY,
+    INPUT_MOVE_LAYER,
+    INPUT_ADJUSTMENT,
+} InputKind;
+
+// One recorded input. Pointer coordinates are in canvas space so a replay
+// does not depend on the pan of the session that produced it. The zoom is
+// recorded as it sizes the grab radius of handles. Layer panel actions
+// name layers by id, which a replay reproduces as it starts from the same
+// new document and creates layers in the same order.
+typedef struct {
+    InputKind kind;
+    gint64 time; // microseconds since the recording started
+    double x, y;
+    Tool *tool;
+    double radius;
+    GdkRGBA color;
+    gboolean enabled; // also: document was restored, layer visible
+    double zoom;
+    guint layer_id;
+    int delta; // layer move
+    AdjustmentType adjustment_type;
+    char *path; // import, owned by loaded recordings
+    AdjustmentParams params;
+    double opacity;
+} InputEvent;
+
+typedef struct {
+    FILE *file;
+    gint64 start;
+} Recorder;
+
+void input_dispatch(AppState *app, const InputEvent *ev);
+
+Recorder *recorder_open(const char *filename, AppState *app, gboolean restored, GError **err);
+void recorder_log(Recorder *rec, InputEvent *ev);
+void recorder_close(Recorder *rec);
+
+GArray *recording_load(const char *filename, GError **err);
+
+#endif
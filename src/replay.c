@@ -0,0 +1,173 @@
+#include "app_state.h"
+#include "layer_stack.h"
+#include "recorder.h"
+#include "replay.h"
+
+// Events recorded within one 60 Hz frame are coalesced into one frame when
+// replaying headless, like GTK would between two draws.
+#define FRAME_US (G_USEC_PER_SEC / 60)
+
+Replay *replay_new(GArray *events, gboolean max_speed)
+{
+    Replay *replay = g_new0(Replay, 1);
+
+    replay->events = events;
+    replay->max_speed = max_speed;
+    replay->processing = g_array_sized_new(FALSE, FALSE, sizeof(gint64), events->len);
+    replay->latency = g_array_new(FALSE, FALSE, sizeof(gint64));
+    return replay;
+}
+
+void replay_free(Replay *replay)
+{
+    if (!replay) return;
+    g_array_free(replay->events, TRUE);
+    g_array_free(replay->processing, TRUE);
+    g_array_free(replay->latency, TRUE);
+    g_free(replay);
+}
+
+static
+void replay_step(Replay *replay, AppState *app)
+{
+    InputEvent *ev = &g_array_index(replay->events, InputEvent, replay->next++);
+    gint64 t0 = g_get_monotonic_time();
+
+    input_dispatch(app, ev);
+
+    gint64 elapsed = g_get_monotonic_time() - t0;
+    g_array_append_val(replay->processing, elapsed);
+    if (!replay->pending_since)
+        replay->pending_since = t0;
+}
+
+// Waits until the recorded timestamp of the next event, if replaying at the
+// recorded speed.
+static
+void wait_for_next(Replay *replay)
+{
+    InputEvent *ev = &g_array_index(replay->events, InputEvent, replay->next);
+    gint64 delay = ev->time - (g_get_monotonic_time() - replay->start);
+
+    if (!replay->max_speed && delay > 0)
+        g_usleep((gulong)delay);
+}
+
+// Replays every event without a display, compositing the document into an
+// offscreen surface at the end of each recorded frame.
+void replay_run_headless(Replay *replay, AppState *app)
+{
+    cairo_surface_t *frame = cairo_image_surface_create(
+        CAIRO_FORMAT_ARGB32, app->layers->width, app->layers->height);
+
+    replay->start = g_get_monotonic_time();
+    while (replay->next < replay->events->len) {
+        gint64 frame_end = g_array_index(replay->events, InputEvent, replay->next).time + FRAME_US;
+
+        do {
+            wait_for_next(replay);
+            replay_step(replay, app);
+        } while (replay->next < replay->events->len
+            && g_array_index(replay->events, InputEvent, replay->next).time < frame_end);
+
+        cairo_t *cr = cairo_create(frame);
+        layer_stack_render(app->layers, cr);
+        cairo_destroy(cr);
+        replay_frame_done(replay);
+    }
+    cairo_surface_destroy(frame);
+}
+
+static
+gboolean replay_tick(gpointer user_data)
+{
+    AppState *app = user_data;
+    Replay *replay = app->replay;
+
+    replay_step(replay, app);
+    gtk_widget_queue_draw(app->drawing_area);
+
+    if (replay->next >= replay->events->len) {
+        replay_report(replay);
+        gtk_main_quit();
+        return G_SOURCE_REMOVE;
+    }
+    if (replay->max_speed)
+        return G_SOURCE_CONTINUE;
+
+    InputEvent *ev = &g_array_index(replay->events, InputEvent, replay->next);
+    gint64 delay = ev->time - (g_get_monotonic_time() - replay->start);
+    g_timeout_add(delay > 0 ? (guint)(delay / 1000) : 0, replay_tick, app);
+    return G_SOURCE_REMOVE;
+}
+
+// Feeds the events through the main loop of a visible window. Idle sources
+// run below GTK's redraw priority, so frames still interleave with the
+// events at maximum speed. The application quits once the report is printed.
+// Returns FALSE, with the report already printed, when there is nothing to
+// replay: the caller must then not enter the main loop.
+gboolean replay_start(Replay *replay, AppState *app)
+{
+    replay->start = g_get_monotonic_time();
+    if (replay->events->len == 0) {
+        replay_report(replay);
+        return FALSE;
+    }
+    if (replay->max_speed)
+        g_idle_add(replay_tick, app);
+    else
+        g_timeout_add((guint)(g_array_index(replay->events, InputEvent, 0).time / 1000),
+            replay_tick, app);
+    return TRUE;
+}
+
+// Called once a frame has been composited, closes the latency measurement
+// opened by the first event dispatched since the previous frame.
+void replay_frame_done(Replay *replay)
+{
+    if (!replay || !replay->pending_since)
+        return;
+
+    gint64 latency = g_get_monotonic_time() - replay->pending_since;
+    g_array_append_val(replay->latency, latency);
+    replay->pending_since = 0;
+}
+
+static
+gint compare_gint64(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *)a;
+    gint64 y = *(const gint64 *)b;
+
+    return (x > y) - (x < y);
+}
+
+static
+void print_stats(const char *label, GArray *samples)
+{
+    if (samples->len == 0) {
+        g_print("%-12s no samples\n", label);
+        return;
+    }
+
+    gint64 total = 0;
+    g_array_sort(samples, compare_gint64);
+    for (guint i = 0; i < samples->len; i++)
+        total += g_array_index(samples, gint64, i);
+
+    g_print("%-12s n=%u mean=%.1fus p50=%" G_GINT64_FORMAT "us p95=%" G_GINT64_FORMAT
+        "us p99=%" G_GINT64_FORMAT "us max=%" G_GINT64_FORMAT "us\n",
+        label, samples->len, (double)total / samples->len,
+        g_array_index(samples, gint64, samples->len / 2),
+        g_array_index(samples, gint64, samples->len * 95 / 100),
+        g_array_index(samples, gint64, samples->len * 99 / 100),
+        g_array_index(samples, gint64, samples->len - 1));
+}
+
+void replay_report(Replay *replay)
+{
+    g_print("replayed %u events in %.3fs\n", replay->events->len,
+        (double)(g_get_monotonic_time() - replay->start) / G_USEC_PER_SEC);
+    print_stats("event", replay->processing);
+    print_stats("frame", replay->latency);
+}
@@ -0,0 +1,27 @@
+#ifndef REPLAY_H
+    #define REPLAY_H
+
+#include <gtk/gtk.h>
+
+typedef struct AppState AppState;
+
+typedef struct {
+    GArray *events; // InputEvent
+    guint next;
+    gboolean max_speed;
+    gint64 start;
+
+    GArray *processing; // gint64 microseconds spent dispatching each event
+    GArray *latency;    // gint64 microseconds from first input to frame
+    gint64 pending_since;
+} Replay;
+
+Replay *replay_new(GArray *events, gboolean max_speed);
+void replay_free(Replay *replay);
+
+void replay_run_headless(Replay *replay, AppState *app);
+gboolean replay_start(Replay *replay, AppState *app);
+void replay_frame_done(Replay *replay);
+void replay_report(Replay *replay);
+
+#endif
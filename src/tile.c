@@ -0,0 +1,75 @@
+#include "tile.h"
+
+// Index of the tile holding canvas coordinate `v`, rounding towards
+// negative infinity.
+int tile_floor(int v)
+{
+    return v >= 0 ? v / TILE_SIZE : -((-v + TILE_SIZE - 1) / TILE_SIZE);
+}
+
+int tile_align_down(int v)
+{
+    return tile_floor(v) * TILE_SIZE;
+}
+
+void tile_rect(const TileKey *key, cairo_rectangle_int_t *rect)
+{
+    *rect = (cairo_rectangle_int_t){ key->tx * TILE_SIZE, key->ty * TILE_SIZE, TILE_SIZE, TILE_SIZE };
+}
+
+guint tile_key_hash(gconstpointer key)
+{
+    const TileKey *t = key;
+
+    return ((guint)t->tx * 73856093u) ^ ((guint)t->ty * 19349663u);
+}
+
+gboolean tile_key_equal(gconstpointer a, gconstpointer b)
+{
+    const TileKey *x = a;
+    const TileKey *y = b;
+
+    return x->tx == y->tx && x->ty == y->ty;
+}
+
+// A set of TileKey, owning its keys.
+GHashTable *tile_set_new(void)
+{
+    return g_hash_table_new_full(tile_key_hash, tile_key_equal, g_free, NULL);
+}
+
+void tile_set_add_rect(GHashTable *set, const cairo_rectangle_int_t *area)
+{
+    TileIter it;
+    TileKey key;
+
+    tile_iter_init(&it, area);
+    while (tile_iter_next(&it, &key))
+        if (!g_hash_table_contains(set, &key))
+            g_hash_table_add(set, g_memdup2(&key, sizeof key));
+}
+
+void tile_iter_init(TileIter *it, const cairo_rectangle_int_t *area)
+{
+    it->tx0 = tile_floor(area->x);
+    it->tx1 = tile_floor(area->x + area->width - 1);
+    it->ty1 = tile_floor(area->y + area->height - 1);
+    it->tx = it->tx0;
+    it->ty = tile_floor(area->y);
+    if (area->width <= 0 || area->height <= 0)
+        it->ty = it->ty1 + 1;
+}
+
+gboolean tile_iter_next(TileIter *it, TileKey *key)
+{
+    if (it->ty > it->ty1)
+        return FALSE;
+
+    key->tx = it->tx;
+    key->ty = it->ty;
+    if (++it->tx > it->tx1) {
+        it->tx = it->tx0;
+        it->ty++;
+    }
+    return TRUE;
+}
@@ -0,0 +1,35 @@
+#ifndef TILE_H
+    #define TILE_H
+
+#include <cairo.h>
+#include <gtk/gtk.h>
+
+// The canvas is split into square tiles aligned on its origin. Layer
+// surfaces grow by whole tiles, and the journal, the histograms and the
+// bucket fill all track their work per tile.
+#define TILE_SHIFT 6
+#define TILE_SIZE (1 << TILE_SHIFT)
+
+typedef struct {
+    gint32 tx, ty;
+} TileKey;
+
+// Visits the tiles overlapping a canvas rectangle, row by row.
+typedef struct {
+    int tx0, tx1, ty1;
+    int tx, ty;
+} TileIter;
+
+int tile_floor(int v);
+int tile_align_down(int v);
+void tile_rect(const TileKey *key, cairo_rectangle_int_t *rect);
+
+guint tile_key_hash(gconstpointer key);
+gboolean tile_key_equal(gconstpointer a, gconstpointer b);
+GHashTable *tile_set_new(void);
+void tile_set_add_rect(GHashTable *set, const cairo_rectangle_int_t *area);
+
+void tile_iter_init(TileIter *it, const cairo_rectangle_int_t *area);
+gboolean tile_iter_next(TileIter *it, TileKey *key);
+
+#endif
@@ -11,10 +11,17 @@ typedef struct Tool {
     void (*on_button_press)(AppState *app, double x, double y);
     void (*on_motion)(AppState *app, double x, double y);
     void (*on_button_release)(AppState *app, double x, double y);
+    // Optional, draws tool feedback over the canvas in canvas coordinates.
+    void (*draw_overlay)(AppState *app, cairo_t *cr);
 } Tool;
 
 extern Tool TOOL_BRUSH;
 extern Tool TOOL_ERASER;
 extern Tool TOOL_BUCKET;
+extern Tool TOOL_TRANSFORM;
+
+// NULL-terminated list of every tool, used to resolve recorded tool names.
+extern Tool *const TOOLS[];
+Tool *tool_find(const char *name);
 
 #endif
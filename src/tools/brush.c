@@ -10,10 +10,18 @@ static double last_x, last_y;
 
 static void brush_point(AppState *app, double cx, double cy)
 {
-    if (!app->active_layer || !app->active_layer->surface)
+    Layer *l = app->active_layer;
+    double r = app->brush_radius;
+    cairo_rectangle_int_t dab = {
+        (int)floor(cx - r) - 1, (int)floor(cy - r) - 1,
+        (int)ceil(2 * r) + 3, (int)ceil(2 * r) + 3
+    };
+
+    if (!layer_stack_clip_to_canvas(app->layers, &dab) || !layer_ensure_rect(l, &dab))
         return;
 
-    cairo_t *cr = cairo_create(app->active_layer->surface);
+    cairo_t *cr = cairo_create(l->surface);
+    cairo_translate(cr, -l->x, -l->y);
     cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
 
     // Use the current brush color from app state
@@ -23,9 +31,13 @@ static void brush_point(AppState *app, double cx, double cy)
         app->brush_color.blue,
         app->brush_color.alpha);
 
+    // The surface grows in whole tiles and may reach past the canvas.
+    cairo_rectangle(cr, dab.x, dab.y, dab.width, dab.height);
+    cairo_clip(cr);
     cairo_arc(cr, cx, cy, app->brush_radius, 0, 2 * M_PI);
     cairo_fill(cr);
     cairo_destroy(cr);
+    app_damage_layer(app, l, &dab);
 }
 
 static void brush_line(AppState *app, double x0, double y0, double x1, double y1)
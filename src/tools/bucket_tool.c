@@ -1,109 +1,242 @@
 #include "tools.h"
 #include "app_state.h"
 #include "layer.h"
+#include "pixel.h"
+#include "tile.h"
 #include <cairo.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
-typedef struct {
-    unsigned char r, g, b, a;
-} Pixel;
+#define FILL_TOLERANCE 10
 
-static gboolean colors_equal(Pixel a, Pixel b, int tolerance)
-{
-    return abs(a.r - b.r) <= tolerance &&
-           abs(a.g - b.g) <= tolerance &&
-           abs(a.b - b.b) <= tolerance &&
-           abs(a.a - b.a) <= tolerance;
-}
+typedef struct { int x, y; } Point;
 
-// Get pixel from a Cairo surface
-static Pixel get_pixel(cairo_surface_t *surface, int x, int y)
+// What the fill knows about one canvas tile: the colors it tests and which
+// pixels it took. Tiles are only set up once the fill reaches them.
+typedef struct {
+    const uint32_t *px; // top-left pixel of the tile, rows `stride` apart
+    int stride;
+    uint32_t *copy;     // owned pixels, when `px` cannot point into the layer
+    guint64 seen[TILE_SIZE]; // one bit per pixel, taken pixels only
+    gboolean any;
+} FillTile;
+
+// A row of `seen` must hold one bit per pixel of a tile row.
+G_STATIC_ASSERT(TILE_SIZE <= 64);
+
+// Colors are tested on the active layer, or with `merged` on the visible
+// composite, rendered one tile at a time. The layer itself is only written
+// once the fill is over, so the colors tested never include the fill.
+typedef struct {
+    Layer *layer;
+    PixelView view; // of the layer, may be empty
+    LayerStack *stack;
+    gboolean merged;
+    int width, height; // canvas
+    int tiles_x;
+    FillTile **tiles;  // canvas grid, NULL until reached
+    uint32_t target;
+} Fill;
+
+static FillTile *load_tile(Fill *f, int tx, int ty)
 {
-    unsigned char *data = cairo_image_surface_get_data(surface);
-    int stride = cairo_image_surface_get_stride(surface);
-    unsigned char *p = data + y * stride + x * 4;
-    Pixel px = { p[2], p[1], p[0], p[3] }; // Cairo stores BGRA
-    return px;
+    FillTile *t = g_new0(FillTile, 1);
+    cairo_rectangle_int_t rect = { tx * TILE_SIZE, ty * TILE_SIZE, TILE_SIZE, TILE_SIZE };
+    int lx = rect.x - f->layer->x;
+    int ly = rect.y - f->layer->y;
+
+    // A tile fully inside the layer surface is read in place.
+    if (!f->merged && f->view.data && lx >= 0 && ly >= 0
+        && lx + TILE_SIZE <= f->view.width && ly + TILE_SIZE <= f->view.height) {
+        t->px = pixel_row(&f->view, ly) + lx;
+        t->stride = f->view.stride / 4;
+        return t;
+    }
+
+    t->copy = g_new0(uint32_t, TILE_SIZE * TILE_SIZE);
+    t->px = t->copy;
+    t->stride = TILE_SIZE;
+    if (f->merged) {
+        int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, TILE_SIZE);
+        cairo_surface_t *surface = cairo_image_surface_create_for_data(
+            (unsigned char *)t->copy, CAIRO_FORMAT_ARGB32, TILE_SIZE, TILE_SIZE, stride);
+        layer_stack_render_rect(f->stack, surface, &rect);
+        cairo_surface_destroy(surface);
+    } else if (f->view.data) {
+        PixelSpanIter it;
+        PixelSpan span;
+        pixel_span_iter_init(&it, &f->view, lx, ly, TILE_SIZE, TILE_SIZE);
+        while (pixel_span_next(&it, &span))
+            memcpy(t->copy + (span.y - ly) * TILE_SIZE + (span.x - lx), span.px, (size_t)span.len * 4);
+    }
+    return t;
 }
 
-// Set pixel on a Cairo surface
-static void set_pixel(cairo_surface_t *surface, int x, int y, Pixel px)
+static inline FillTile *tile_at(Fill *f, int x, int y)
 {
-    unsigned char *data = cairo_image_surface_get_data(surface);
-    int stride = cairo_image_surface_get_stride(surface);
-    unsigned char *p = data + y * stride + x * 4;
-    p[2] = px.r;
-    p[1] = px.g;
-    p[0] = px.b;
-    p[3] = px.a;
+    FillTile **slot = f->tiles + (y >> TILE_SHIFT) * f->tiles_x + (x >> TILE_SHIFT);
+
+    if (!*slot)
+        *slot = load_tile(f, x >> TILE_SHIFT, y >> TILE_SHIFT);
+    return *slot;
 }
 
-static void flood_fill(AppState *app, cairo_surface_t *surface, int x, int y)
+// Canvas pixel not taken yet and close enough to the target color.
+static inline gboolean matches(Fill *f, int x, int y)
 {
-    int width = cairo_image_surface_get_width(surface);
-    int height = cairo_image_surface_get_height(surface);
+    FillTile *t = tile_at(f, x, y);
+    int tx = x & (TILE_SIZE - 1);
+    int ty = y & (TILE_SIZE - 1);
 
-    cairo_surface_flush(surface);
-
-    unsigned char *data = cairo_image_surface_get_data(surface);
-    int stride = cairo_image_surface_get_stride(surface);
+    if (t->seen[ty] >> tx & 1)
+        return FALSE;
+    return pixel_within(t->px[ty * t->stride + tx], f->target, FILL_TOLERANCE);
+}
 
-    Pixel target = get_pixel(surface, x, y);
+static inline void take(Fill *f, int x, int y)
+{
+    FillTile *t = tile_at(f, x, y);
 
-    GdkRGBA c = app->brush_color;
-    Pixel fill = {
-        (unsigned char)(c.red * 255),
-        (unsigned char)(c.green * 255),
-        (unsigned char)(c.blue * 255),
-        (unsigned char)(c.alpha * 255)
-    };
+    t->seen[y & (TILE_SIZE - 1)] |= (guint64)1 << (x & (TILE_SIZE - 1));
+    t->any = TRUE;
+}
 
-    if (colors_equal(target, fill, 0)) return; // No need to fill same color
+// Scanline flood fill (4-connected) over the canvas: every run of matching
+// pixels is taken in one pass over its row, and only the start of each
+// matching run on the rows above and below is pushed as a new seed.
+// Returns the bounding box of the taken pixels in canvas coordinates.
+static cairo_rectangle_int_t flood_fill(Fill *f, int x, int y)
+{
+    int min_x = x, max_x = x, min_y = y, max_y = y;
 
-    bool *visited = calloc(width * height, sizeof(bool));
-    if (!visited) return;
+    GArray *stack = g_array_new(FALSE, FALSE, sizeof(Point));
+    Point seed = { x, y };
+    g_array_append_val(stack, seed);
 
-    // Simple stack-based flood fill (4-connected)
-    typedef struct { int x, y; } Point;
-    Point *stack = malloc(width * height * sizeof(Point));
-    int sp = 0;
-    stack[sp++] = (Point){ x, y };
+    while (stack->len > 0) {
+        Point p = g_array_index(stack, Point, stack->len - 1);
+        g_array_set_size(stack, stack->len - 1);
 
-    while (sp > 0) {
-        Point p = stack[--sp];
-        if (p.x < 0 || p.y < 0 || p.x >= width || p.y >= height)
+        if (!matches(f, p.x, p.y))
             continue;
-        int idx = p.y * width + p.x;
-        if (visited[idx]) continue;
 
-        Pixel cur = get_pixel(surface, p.x, p.y);
-        if (!colors_equal(cur, target, 10)) continue; // tolerance of 10
+        int x0 = p.x;
+        int x1 = p.x;
+        while (x0 > 0 && matches(f, x0 - 1, p.y))
+            x0--;
+        while (x1 < f->width - 1 && matches(f, x1 + 1, p.y))
+            x1++;
+
+        for (int i = x0; i <= x1; i++)
+            take(f, i, p.y);
+        min_x = MIN(min_x, x0);
+        max_x = MAX(max_x, x1);
+        min_y = MIN(min_y, p.y);
+        max_y = MAX(max_y, p.y);
+
+        for (int ny = p.y - 1; ny <= p.y + 1; ny += 2) {
+            if (ny < 0 || ny >= f->height) continue;
+            gboolean in_run = FALSE;
+
+            for (int i = x0; i <= x1; i++) {
+                gboolean match = matches(f, i, ny);
+                if (match && !in_run) {
+                    Point next = { i, ny };
+                    g_array_append_val(stack, next);
+                }
+                in_run = match;
+            }
+        }
+    }
 
-        visited[idx] = TRUE;
-        set_pixel(surface, p.x, p.y, fill);
+    g_array_free(stack, TRUE);
+    return (cairo_rectangle_int_t){ min_x, min_y, max_x - min_x + 1, max_y - min_y + 1 };
+}
 
-        stack[sp++] = (Point){ p.x + 1, p.y };
-        stack[sp++] = (Point){ p.x - 1, p.y };
-        stack[sp++] = (Point){ p.x, p.y + 1 };
-        stack[sp++] = (Point){ p.x, p.y - 1 };
+// Writes `fill` over the taken pixels of every reached tile.
+static void paint_taken(Fill *f, uint32_t fill)
+{
+    Layer *l = f->layer;
+    PixelView view;
+    int tiles_y = (f->height + TILE_SIZE - 1) / TILE_SIZE;
+
+    if (!pixel_view_init(&view, l->surface))
+        return;
+    for (int i = 0; i < f->tiles_x * tiles_y; i++) {
+        FillTile *t = f->tiles[i];
+        if (!t || !t->any) continue;
+
+        int x0 = (i % f->tiles_x) * TILE_SIZE - l->x;
+        int y0 = (i / f->tiles_x) * TILE_SIZE - l->y;
+        for (int y = 0; y < TILE_SIZE; y++) {
+            guint64 bits = t->seen[y];
+            if (!bits) continue;
+            uint32_t *row = pixel_row(&view, y0 + y);
+            for (int x = 0; x < TILE_SIZE; x++)
+                if (bits >> x & 1)
+                    row[x0 + x] = fill;
+        }
     }
+    cairo_surface_mark_dirty(l->surface);
+}
 
-    free(stack);
-    free(visited);
+static void fill_free(Fill *f)
+{
+    int tiles_y = (f->height + TILE_SIZE - 1) / TILE_SIZE;
 
-    cairo_surface_mark_dirty(surface);
+    for (int i = 0; i < f->tiles_x * tiles_y; i++) {
+        if (!f->tiles[i]) continue;
+        g_free(f->tiles[i]->copy);
+        g_free(f->tiles[i]);
+    }
+    g_free(f->tiles);
 }
 
 static void on_button_press(AppState *app, double x, double y)
 {
-    if (!app->active_layer || !app->active_layer->surface)
-        return;
-
+    Layer *l = app->active_layer;
     int px = (int)round(x);
     int py = (int)round(y);
 
-    flood_fill(app, app->active_layer->surface, px, py);
+    if (!layer_is_paintable(l) || px < 0 || py < 0
+        || px >= app->layers->width || py >= app->layers->height)
+        return;
+
+    Fill f = {
+        .layer = l,
+        .stack = app->layers,
+        .merged = app->sample_merged,
+        .width = app->layers->width,
+        .height = app->layers->height,
+        .tiles_x = (app->layers->width + TILE_SIZE - 1) / TILE_SIZE,
+    };
+    int tiles_y = (f.height + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t fill = pixel_from_rgba(&app->brush_color);
+
+    f.tiles = g_new0(FillTile *, (gsize)f.tiles_x * tiles_y);
+    if (!pixel_view_init(&f.view, l->surface))
+        f.view = (PixelView){ 0 };
+
+    FillTile *seed = tile_at(&f, px, py);
+    f.target = seed->px[(py & (TILE_SIZE - 1)) * seed->stride + (px & (TILE_SIZE - 1))];
+    // No need to fill same color, unless other layers make it look so.
+    if (!f.merged && f.target == fill) {
+        fill_free(&f);
+        return;
+    }
+
+    // Only the filled area is added to the layer.
+    cairo_rectangle_int_t filled = flood_fill(&f, px, py);
+    if (layer_ensure_rect(l, &filled)) {
+        paint_taken(&f, fill);
+        app_damage_layer(app, l, &filled);
+    }
+    fill_free(&f);
+
+    // A transparent fill clears pixels.
+    if (PIXEL_A(fill) == 0)
+        layer_crop_cleared(l, &filled);
 }
 
 static void on_motion(AppState *app, double x, double y) { (void)app; (void)x; (void)y; }
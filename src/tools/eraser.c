@@ -7,17 +7,35 @@
 
 static gboolean is_erasing = FALSE;
 static double last_x, last_y;
+static cairo_rectangle_int_t stroke; // canvas area erased by the stroke
 
 static void erase_point(AppState *app, double cx, double cy)
 {
-    if (!app->active_layer || !app->active_layer->surface)
+    Layer *l = app->active_layer;
+    if (!layer_is_paintable(l) || !l->surface)
         return;
 
-    cairo_t *cr = cairo_create(app->active_layer->surface);
+    double r = app->brush_radius;
+    cairo_rectangle_int_t dab = {
+        (int)floor(cx - r) - 1, (int)floor(cy - r) - 1,
+        (int)ceil(2 * r) + 3, (int)ceil(2 * r) + 3
+    };
+    if (!layer_stack_clip_to_canvas(app->layers, &dab))
+        return;
+
+    cairo_t *cr = cairo_create(l->surface);
+    cairo_translate(cr, -l->x, -l->y);
     cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    cairo_rectangle(cr, dab.x, dab.y, dab.width, dab.height);
+    cairo_clip(cr);
     cairo_arc(cr, cx, cy, app->brush_radius, 0, 2 * M_PI);
     cairo_fill(cr);
     cairo_destroy(cr);
+    app_damage_layer(app, l, &dab);
+    if (stroke.width <= 0 || stroke.height <= 0)
+        stroke = dab;
+    else
+        gdk_rectangle_union(&stroke, &dab, &stroke);
 }
 
 static void erase_line(AppState *app, double x0, double y0, double x1, double y1)
@@ -38,6 +56,7 @@ static void erase_line(AppState *app, double x0, double y0, double x1, double y1
 static void on_button_press(AppState *app, double x, double y)
 {
     is_erasing = TRUE;
+    stroke = (cairo_rectangle_int_t){ 0, 0, 0, 0 };
     erase_point(app, x, y);
 }
 
@@ -53,6 +72,8 @@ static void on_motion(AppState *app, double x, double y)
 static void on_button_release(AppState *app, double x, double y)
 {
     is_erasing = FALSE;
+    // Give back the memory of borders the stroke left transparent.
+    layer_crop_cleared(app->active_layer, &stroke);
 }
 
 Tool TOOL_ERASER = {
@@ -0,0 +1,19 @@
+#include <string.h>
+
+#include "tools.h"
+
+Tool *const TOOLS[] = {
+    &TOOL_BRUSH,
+    &TOOL_ERASER,
+    &TOOL_BUCKET,
+    &TOOL_TRANSFORM,
+    NULL
+};
+
+Tool *tool_find(const char *name)
+{
+    for (size_t i = 0; TOOLS[i] != NULL; i++)
+        if (strcmp(TOOLS[i]->name, name) == 0)
+            return TOOLS[i];
+    return NULL;
+}
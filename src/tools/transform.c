@@ -0,0 +1,483 @@
+#include <cairo.h>
+#include <math.h>
+
+#include "app_state.h"
+#include "layer.h"
+#include "pixel.h"
+#include "tools.h"
+
+// Longest side of the downscaled copy drawn while dragging.
+#define PROXY_MAX_SIDE 1024
+// Rows of the destination resampled by one worker task.
+#define BAND_HEIGHT 64
+// Handle grab radius, in screen pixels.
+#define HANDLE_RADIUS 8.0
+
+typedef enum {
+    DRAG_NONE,
+    DRAG_MOVE,
+    DRAG_SCALE,
+    DRAG_ROTATE,
+} DragMode;
+
+typedef struct {
+    AppState *app;
+    Layer *layer;
+    cairo_surface_t *src;
+    PixelView src_view;
+    cairo_surface_t *dst;
+    PixelView dst_view;
+    cairo_rectangle_int_t dst_rect;
+    cairo_matrix_t to_src; // destination pixel center to source coordinates
+    gint remaining;
+    cairo_rectangle_int_t *boxes; // alpha bounding box of each band, dst pixels
+    int bands;
+    cairo_rectangle_int_t crop; // canvas area of `dst` once cropped
+    gboolean empty;
+} ResampleJob;
+
+typedef struct {
+    ResampleJob *job;
+    int index;
+    int y0, y1;
+} ResampleBand;
+
+static Layer *target = NULL;
+static cairo_rectangle_int_t orig;
+static DragMode mode = DRAG_NONE;
+static double press_x, press_y;
+static double tx, ty, angle, scale = 1.0;
+static double proxy_scale;
+
+static GThreadPool *resample_pool = NULL;
+
+// Original canvas coordinates to transformed canvas coordinates.
+static void current_matrix(cairo_matrix_t *m)
+{
+    double cx = orig.x + orig.width / 2.0;
+    double cy = orig.y + orig.height / 2.0;
+
+    cairo_matrix_init_translate(m, cx + tx, cy + ty);
+    cairo_matrix_rotate(m, angle);
+    cairo_matrix_scale(m, scale, scale);
+    cairo_matrix_translate(m, -cx, -cy);
+}
+
+static void transformed_extents(const cairo_matrix_t *m, cairo_rectangle_int_t *out)
+{
+    double xs[4] = { orig.x, orig.x + orig.width, orig.x, orig.x + orig.width };
+    double ys[4] = { orig.y, orig.y, orig.y + orig.height, orig.y + orig.height };
+    double x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+
+    for (int i = 0; i < 4; i++) {
+        cairo_matrix_transform_point(m, &xs[i], &ys[i]);
+        x0 = fmin(x0, xs[i]);
+        y0 = fmin(y0, ys[i]);
+        x1 = fmax(x1, xs[i]);
+        y1 = fmax(y1, ys[i]);
+    }
+    out->x = (int)floor(x0);
+    out->y = (int)floor(y0);
+    out->width = (int)ceil(x1) - out->x;
+    out->height = (int)ceil(y1) - out->y;
+}
+
+static void update_preview(Layer *l)
+{
+    cairo_matrix_t m;
+    cairo_rectangle_int_t before = l->bounds;
+
+    current_matrix(&m);
+    l->preview = m;
+    cairo_matrix_translate(&l->preview, orig.x, orig.y);
+    cairo_matrix_scale(&l->preview, 1 / proxy_scale, 1 / proxy_scale);
+    transformed_extents(&m, &l->bounds);
+    // Group caches only redraw the area the preview left and now covers.
+    layer_mark_dirty_rect(l, &before);
+    layer_mark_dirty_rect(l, &l->bounds);
+}
+
+// Reuses the proxy of a previous transform when the layer was neither
+// painted on nor cropped since; whole pixel moves keep it up to date.
+static void ensure_proxy(Layer *l)
+{
+    int side = MAX(orig.width, orig.height);
+    proxy_scale = side > PROXY_MAX_SIDE ? (double)PROXY_MAX_SIDE / side : 1.0;
+
+    if (l->proxy && gdk_rectangle_equal(&l->proxy_rect, &orig))
+        return;
+    if (l->proxy)
+        cairo_surface_destroy(l->proxy);
+
+    l->proxy = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+        MAX(1, (int)ceil(orig.width * proxy_scale)), MAX(1, (int)ceil(orig.height * proxy_scale)));
+    l->proxy_rect = orig;
+    cairo_t *cr = cairo_create(l->proxy);
+    cairo_scale(cr, proxy_scale, proxy_scale);
+    cairo_set_source_surface(cr, l->surface, l->x - orig.x, l->y - orig.y);
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+}
+
+// Keys cubic convolution kernel (a = -0.5), i.e. Catmull-Rom.
+static inline double cubic_weight(double t)
+{
+    t = fabs(t);
+    if (t < 1.0)
+        return (1.5 * t - 2.5) * t * t + 1.0;
+    if (t < 2.0)
+        return ((-0.5 * t + 2.5) * t - 4.0) * t + 2.0;
+    return 0.0;
+}
+
+static uint32_t sample_bicubic(const PixelView *src, double sx, double sy)
+{
+    double fx = sx - 0.5;
+    double fy = sy - 0.5;
+    int ix = (int)floor(fx);
+    int iy = (int)floor(fy);
+
+    if (ix < -2 || iy < -2 || ix > src->width || iy > src->height)
+        return 0;
+
+    double wx[4], wy[4];
+    for (int k = 0; k < 4; k++) {
+        wx[k] = cubic_weight(fx - (ix - 1 + k));
+        wy[k] = cubic_weight(fy - (iy - 1 + k));
+    }
+
+    double acc[4] = { 0 };
+    for (int j = 0; j < 4; j++) {
+        int y = iy - 1 + j;
+        if (y < 0 || y >= src->height || wy[j] == 0.0) continue;
+        const uint32_t *row = pixel_row(src, y);
+        for (int i = 0; i < 4; i++) {
+            int x = ix - 1 + i;
+            if (x < 0 || x >= src->width) continue;
+            double w = wx[i] * wy[j];
+            uint32_t p = row[x];
+            acc[0] += w * PIXEL_A(p);
+            acc[1] += w * PIXEL_R(p);
+            acc[2] += w * PIXEL_G(p);
+            acc[3] += w * PIXEL_B(p);
+        }
+    }
+
+    // Premultiplied data: the overshoot of the kernel must not leave a
+    // color channel above alpha.
+    double a = CLAMP(acc[0], 0.0, 255.0);
+    return PIXEL_PACK(lround(a),
+        lround(CLAMP(acc[1], 0.0, a)),
+        lround(CLAMP(acc[2], 0.0, a)),
+        lround(CLAMP(acc[3], 0.0, a)));
+}
+
+// Also stores in `box` the bounding box of the non-transparent pixels written.
+static void resample_rows(ResampleJob *job, int y0, int y1, cairo_rectangle_int_t *box)
+{
+    int left = job->dst_view.width, right = 0, top = y1, bottom = y0;
+
+    for (int y = y0; y < y1; y++) {
+        uint32_t *row = pixel_row(&job->dst_view, y);
+        for (int x = 0; x < job->dst_view.width; x++) {
+            double sx = x + 0.5;
+            double sy = y + 0.5;
+            cairo_matrix_transform_point(&job->to_src, &sx, &sy);
+            row[x] = sample_bicubic(&job->src_view, sx, sy);
+            if (PIXEL_A(row[x])) {
+                left = MIN(left, x);
+                right = MAX(right, x + 1);
+                top = MIN(top, y);
+                bottom = y + 1;
+            }
+        }
+    }
+    *box = right > left
+        ? (cairo_rectangle_int_t){ left, top, right - left, bottom - top }
+        : (cairo_rectangle_int_t){ 0, 0, 0, 0 };
+}
+
+// Crops the result to the union of the band boxes before it reaches the
+// main loop, which then has no transparent corners to scan or copy. An
+// empty result keeps one transparent pixel and is dropped on finish.
+static void crop_result(ResampleJob *job)
+{
+    cairo_rectangle_int_t box = { 0, 0, 0, 0 };
+
+    cairo_surface_mark_dirty(job->dst);
+    for (int i = 0; i < job->bands; i++) {
+        const cairo_rectangle_int_t *b = &job->boxes[i];
+        if (b->width <= 0) continue;
+        if (box.width <= 0)
+            box = *b;
+        else
+            gdk_rectangle_union(&box, b, &box);
+    }
+    if (box.width <= 0) {
+        job->empty = TRUE;
+        box = (cairo_rectangle_int_t){ 0, 0, 1, 1 };
+    }
+    job->crop = (cairo_rectangle_int_t){
+        job->dst_rect.x + box.x, job->dst_rect.y + box.y, box.width, box.height };
+    if (box.width == job->dst_view.width && box.height == job->dst_view.height)
+        return;
+
+    cairo_surface_t *cropped = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, box.width, box.height);
+    cairo_t *cr = cairo_create(cropped);
+    cairo_set_source_surface(cr, job->dst, -box.x, -box.y);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(job->dst);
+    job->dst = cropped;
+}
+
+static gboolean finish_resample(gpointer user_data)
+{
+    ResampleJob *job = user_data;
+    Layer *l = job->layer;
+    cairo_rectangle_int_t before = orig;
+
+    cairo_surface_destroy(l->surface);
+    cairo_surface_destroy(job->src);
+    cairo_surface_destroy(l->proxy);
+    l->surface = job->dst;
+    l->proxy = NULL;
+    l->x = job->crop.x;
+    l->y = job->crop.y;
+    l->bounds = job->crop;
+    l->locked = FALSE;
+    target = NULL;
+
+    // Old and new areas both changed.
+    app_damage_layer(job->app, l, &before);
+    app_damage_layer(job->app, l, &job->dst_rect);
+    if (job->empty)
+        layer_autocrop(l);
+    if (job->app->drawing_area)
+        gtk_widget_queue_draw(job->app->drawing_area);
+    g_free(job->boxes);
+    g_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+static void resample_band(gpointer data, gpointer user_data)
+{
+    ResampleBand *band = data;
+    ResampleJob *job = band->job;
+
+    resample_rows(job, band->y0, band->y1, &job->boxes[band->index]);
+    if (g_atomic_int_dec_and_test(&job->remaining)) {
+        crop_result(job);
+        g_idle_add(finish_resample, job);
+    }
+    g_free(band);
+}
+
+// Resamples the layer at full resolution on the worker pool, one band of
+// rows per task. The preview stays on screen until the result is swapped
+// in from the main loop. Without a window (headless replay) there is no
+// main loop to come back to, so the work is done inline.
+static void commit_resample(AppState *app, Layer *l, const cairo_matrix_t *m)
+{
+    ResampleJob *job = g_new0(ResampleJob, 1);
+    cairo_matrix_t inv = *m;
+
+    cairo_matrix_invert(&inv);
+    job->app = app;
+    job->layer = l;
+    job->src = cairo_surface_reference(l->surface);
+    transformed_extents(m, &job->dst_rect);
+    job->dst = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+        MAX(1, job->dst_rect.width), MAX(1, job->dst_rect.height));
+    if (!pixel_view_init(&job->src_view, job->src) || !pixel_view_init(&job->dst_view, job->dst)) {
+        cairo_surface_destroy(job->dst);
+        job->dst = cairo_surface_reference(job->src);
+        job->dst_rect = (cairo_rectangle_int_t){ l->x, l->y,
+            cairo_image_surface_get_width(job->src), cairo_image_surface_get_height(job->src) };
+        job->crop = job->dst_rect;
+        finish_resample(job);
+        return;
+    }
+
+    // destination pixel -> canvas -> original canvas -> source pixel
+    cairo_matrix_t to_canvas;
+    cairo_matrix_t to_layer;
+    cairo_matrix_init_translate(&to_canvas, job->dst_rect.x, job->dst_rect.y);
+    cairo_matrix_init_translate(&to_layer, -l->x, -l->y);
+    cairo_matrix_multiply(&job->to_src, &to_canvas, &inv);
+    cairo_matrix_multiply(&job->to_src, &job->to_src, &to_layer);
+
+    if (!app->drawing_area) {
+        job->bands = 1;
+        job->boxes = g_new0(cairo_rectangle_int_t, 1);
+        resample_rows(job, 0, job->dst_view.height, &job->boxes[0]);
+        crop_result(job);
+        finish_resample(job);
+        return;
+    }
+
+    if (!resample_pool)
+        resample_pool = g_thread_pool_new(resample_band, NULL,
+            (gint)g_get_num_processors(), FALSE, NULL);
+
+    job->bands = (job->dst_view.height + BAND_HEIGHT - 1) / BAND_HEIGHT;
+    job->boxes = g_new0(cairo_rectangle_int_t, job->bands);
+    job->remaining = job->bands;
+    for (int y = 0; y < job->dst_view.height; y += BAND_HEIGHT) {
+        ResampleBand *band = g_new0(ResampleBand, 1);
+        band->job = job;
+        band->index = y / BAND_HEIGHT;
+        band->y0 = y;
+        band->y1 = MIN(y + BAND_HEIGHT, job->dst_view.height);
+        g_thread_pool_push(resample_pool, band, NULL);
+    }
+}
+
+static DragMode pick_mode(AppState *app, double x, double y)
+{
+    cairo_matrix_t m;
+    double grab = HANDLE_RADIUS / app->zoom;
+
+    current_matrix(&m);
+    for (int i = 0; i < 4; i++) {
+        double hx = orig.x + (i & 1 ? orig.width : 0);
+        double hy = orig.y + (i & 2 ? orig.height : 0);
+        cairo_matrix_transform_point(&m, &hx, &hy);
+        if (hypot(x - hx, y - hy) <= grab)
+            return DRAG_SCALE;
+    }
+
+    double ox = x;
+    double oy = y;
+    cairo_matrix_invert(&m);
+    cairo_matrix_transform_point(&m, &ox, &oy);
+    if (ox >= orig.x && oy >= orig.y && ox <= orig.x + orig.width && oy <= orig.y + orig.height)
+        return DRAG_MOVE;
+    return DRAG_ROTATE;
+}
+
+// Dragging inside the layer moves it, a corner handle scales it about its
+// center and anywhere outside rotates it.
+static void on_button_press(AppState *app, double x, double y)
+{
+    Layer *l = app->active_layer;
+
+    if (target || !layer_is_paintable(l) || !l->surface
+        || l->bounds.width <= 0 || l->bounds.height <= 0)
+        return;
+
+    target = l;
+    orig = l->bounds;
+    tx = ty = angle = 0.0;
+    scale = 1.0;
+    mode = pick_mode(app, x, y);
+    press_x = x;
+    press_y = y;
+
+    ensure_proxy(l);
+    l->locked = TRUE;
+    update_preview(l);
+}
+
+static void on_motion(AppState *app, double x, double y)
+{
+    if (!target || mode == DRAG_NONE)
+        return;
+
+    double cx = orig.x + orig.width / 2.0 + tx;
+    double cy = orig.y + orig.height / 2.0 + ty;
+
+    switch (mode) {
+    case DRAG_MOVE:
+        // Whole pixel moves only shift the layer offset on commit.
+        tx = round(x - press_x);
+        ty = round(y - press_y);
+        break;
+    case DRAG_SCALE: {
+        double from = hypot(press_x - cx, press_y - cy);
+        if (from > 0)
+            scale = fmax(0.01, hypot(x - cx, y - cy) / from);
+        break;
+    }
+    case DRAG_ROTATE:
+        angle = atan2(y - cy, x - cx) - atan2(press_y - cy, press_x - cx);
+        break;
+    case DRAG_NONE:
+        break;
+    }
+    update_preview(target);
+}
+
+static void on_button_release(AppState *app, double x, double y)
+{
+    Layer *l = target;
+
+    if (!l || mode == DRAG_NONE)
+        return;
+    mode = DRAG_NONE;
+
+    // A click without a drag: only the proxy on screen goes back to pixels.
+    if (tx == 0.0 && ty == 0.0 && angle == 0.0 && scale == 1.0) {
+        l->locked = FALSE;
+        l->bounds = orig;
+        target = NULL;
+        layer_mark_dirty_rect(l, &orig);
+        return;
+    }
+
+    if (angle == 0.0 && scale == 1.0) {
+        cairo_rectangle_int_t after = { orig.x + (int)tx, orig.y + (int)ty, orig.width, orig.height };
+
+        // The pixels did not change: keep the proxy for the next transform.
+        cairo_surface_t *proxy = l->proxy;
+        l->proxy = NULL;
+        l->locked = FALSE;
+        l->x += (int)tx;
+        l->y += (int)ty;
+        target = NULL;
+        app_damage_layer(app, l, &orig);
+        app_damage_layer(app, l, &after);
+        l->bounds = after;
+        l->proxy = proxy;
+        l->proxy_rect = after;
+        return;
+    }
+
+    cairo_matrix_t m;
+    current_matrix(&m);
+    commit_resample(app, l, &m);
+}
+
+static void draw_overlay(AppState *app, cairo_t *cr)
+{
+    Layer *l = target ? target : app->active_layer;
+
+    if (!l || l->kind != LAYER_KIND_PIXEL || l->bounds.width <= 0)
+        return;
+
+    cairo_matrix_t m;
+    cairo_rectangle_int_t r = target ? orig : l->bounds;
+    if (target) {
+        current_matrix(&m);
+    } else {
+        cairo_matrix_init_identity(&m);
+    }
+
+    cairo_save(cr);
+    cairo_transform(cr, &m);
+    cairo_rectangle(cr, r.x, r.y, r.width, r.height);
+    cairo_restore(cr);
+    cairo_set_line_width(cr, 1.0 / app->zoom);
+    cairo_set_source_rgba(cr, 0.2, 0.6, 1.0, 0.9);
+    cairo_stroke(cr);
+}
+
+Tool TOOL_TRANSFORM = {
+    .name = "Transform",
+    .on_button_press = on_button_press,
+    .on_motion = on_motion,
+    .on_button_release = on_button_release,
+    .draw_overlay = draw_overlay
+};
@@ -0,0 +1,13 @@
+#include "widgets.h"
+
+static
+void destroy_widget_cb(GtkWidget *widget, gpointer user_data)
+{
+    gtk_widget_destroy(widget);
+}
+
+// Destroys every child of `container`.
+void widgets_clear(GtkWidget *container)
+{
+    gtk_container_foreach(GTK_CONTAINER(container), (GtkCallback)destroy_widget_cb, NULL);
+}
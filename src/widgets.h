@@ -0,0 +1,8 @@
+#ifndef WIDGETS_H
+    #define WIDGETS_H
+
+#include <gtk/gtk.h>
+
+void widgets_clear(GtkWidget *container);
+
+#endif